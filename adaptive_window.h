@@ -0,0 +1,264 @@
+// @brief: double click window learned from the user's own click intervals
+//
+// every device/button keeps a small histogram of the intervals between
+// the two clicks of a double click. the window is a high percentile of it
+// plus a margin, kept within the configured bounds. old samples fade out
+// by halving the counts. the histograms are saved to a text file so the
+// window survives restarts.
+//
+// only double clicks inside the current window can be seen, so a second
+// click that comes soon after a timed out single click of the same button
+// is counted too, or the window could only ever shrink. two single clicks
+// look the same, such a pair counts only when a double click that made it
+// follows within RETRY_TICKS: the user tried again.
+//
+// Sample() runs on the event path and does no I/O, the owner calls Save()
+// from its loop when Due() and at exit
+
+#ifndef ADAPTIVE_WINDOW_H
+#define ADAPTIVE_WINDOW_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+
+class AdaptiveWindow
+{
+    public:
+        enum {
+            MAX_ENTRIES = 16,           // device/button pairs
+            BUCKET_SHIFT = 14,          // 16.384 ms per bucket
+            BUCKETS = 32,               // up to 524 ms
+            MIN_SAMPLES = 16,           // before the window moves
+            MAX_TOTAL = 1024,           // then halve, old samples fade out
+            PERCENTILE = 95,
+            MARGIN_TICKS = 30 * TICKS_PER_MS,
+            RETRY_TICKS = 2 * TICKS_PER_SEC,
+            SAVE_EVERY = 8,             // samples between saves
+            SAVE_TICKS = 60 * TICKS_PER_SEC
+        };
+
+    public:
+        // window bounds in ticks, path NULL does not persist
+        AdaptiveWindow(tick_t min, tick_t max, tick_t initial, const char *path)
+        :m_tick_min(min),
+        m_tick_max(max),
+        m_tick_initial(initial),
+        m_path(path),
+        m_nUnsaved(0),
+        m_tick_saved(NowTick())
+        {
+            memset(m_entries, 0, sizeof(m_entries));
+        }
+
+        tick_t Max()
+        {
+            return m_tick_max;
+        }
+
+        // window for a new click of button on dev
+        tick_t Window(int dev, int button)
+        {
+            entry *e = Find(dev, button, false);
+            return e ? e->window : Clamp(m_tick_initial);
+        }
+
+        // interval between the two clicks of a double click
+        void Sample(int dev, int button, tick_t interval)
+        {
+            entry *e = Find(dev, button, true);
+            if (e == NULL)
+            {
+                return;
+            }
+
+            unsigned n = (unsigned)(interval >> BUCKET_SHIFT);
+            e->count[n < BUCKETS ? n : BUCKETS - 1]++;
+            if (++e->total >= MAX_TOTAL)
+            {
+                e->total = 0;
+                for (int i = 0; i < BUCKETS; i++)
+                {
+                    e->count[i] >>= 1;
+                    e->total += e->count[i];
+                }
+            }
+            Update(*e);
+            m_nUnsaved++;
+        }
+
+        // enough new samples, or some for a while
+        bool Due(tick_t now)
+        {
+            return m_path && (m_nUnsaved >= SAVE_EVERY ||
+                    (m_nUnsaved > 0 && now - m_tick_saved >= SAVE_TICKS));
+        }
+
+        // "dev button c0 .. c31" per line
+        bool Load()
+        {
+            FILE *fp = fopen(m_path, "r");
+            if (fp == NULL)
+            {
+                return false;
+            }
+
+            int dev, button;
+            while (fscanf(fp, "%d %d", &dev, &button) == 2)
+            {
+                entry *e = Find(dev, button, true);
+                for (int i = 0; i < BUCKETS; i++)
+                {
+                    unsigned c = 0;
+                    if (fscanf(fp, "%u", &c) != 1)
+                    {
+                        fclose(fp);
+                        return false;
+                    }
+                    if (e)
+                    {
+                        e->count[i] = c < MAX_TOTAL ? c : MAX_TOTAL - 1;
+                    }
+                }
+                if (e)
+                {
+                    e->total = 0;
+                    for (int i = 0; i < BUCKETS; i++)
+                    {
+                        e->total += e->count[i];
+                    }
+                    Update(*e);
+                }
+            }
+            fclose(fp);
+            return true;
+        }
+
+        // write a new file and rename it over the old one
+        bool Save()
+        {
+            if (m_path == NULL)
+            {
+                return false;
+            }
+            m_nUnsaved = 0;
+            m_tick_saved = NowTick();
+
+            char tmp[256];
+            snprintf(tmp, sizeof(tmp), "%s.tmp", m_path);
+            FILE *fp = fopen(tmp, "w");
+            if (fp == NULL)
+            {
+                return false;
+            }
+            for (int i = 0; i < MAX_ENTRIES; i++)
+            {
+                entry &e = m_entries[i];
+                if (!e.used)
+                {
+                    continue;
+                }
+                fprintf(fp, "%d %d", e.dev, e.button);
+                for (int j = 0; j < BUCKETS; j++)
+                {
+                    fprintf(fp, " %u", (unsigned)e.count[j]);
+                }
+                fprintf(fp, "\n");
+            }
+            if (fclose(fp) != 0)
+            {
+                return false;
+            }
+            return rename(tmp, m_path) == 0;
+        }
+
+    private:
+        struct entry
+        {
+            bool used;
+            int dev;
+            int button;
+            uint16_t count[BUCKETS];
+            uint16_t total;
+            tick_t window;
+        };
+
+        entry *Find(int dev, int button, bool bCreate)
+        {
+            entry *pFree = NULL;
+            for (int i = 0; i < MAX_ENTRIES; i++)
+            {
+                entry &e = m_entries[i];
+                if (!e.used)
+                {
+                    if (pFree == NULL)
+                    {
+                        pFree = &e;
+                    }
+                }
+                else if (e.dev == dev && e.button == button)
+                {
+                    return &e;
+                }
+            }
+
+            if (!bCreate || pFree == NULL)
+            {
+                return NULL;
+            }
+            pFree->used = true;
+            pFree->dev = dev;
+            pFree->button = button;
+            pFree->window = Clamp(m_tick_initial);
+            return pFree;
+        }
+
+        // upper edge of the PERCENTILE bucket plus margin
+        void Update(entry &e)
+        {
+            if (e.total < MIN_SAMPLES)
+            {
+                e.window = Clamp(m_tick_initial);
+                return;
+            }
+
+            unsigned nNeed = (unsigned)e.total * PERCENTILE;
+            unsigned nSum = 0;
+            int i = 0;
+            for (; i < BUCKETS - 1; i++)
+            {
+                nSum += e.count[i];
+                if (nSum * 100 >= nNeed)
+                {
+                    break;
+                }
+            }
+            e.window = Clamp(((tick_t)(i + 1) << BUCKET_SHIFT) + MARGIN_TICKS);
+        }
+
+        tick_t Clamp(tick_t window)
+        {
+            if (window < m_tick_min)
+            {
+                return m_tick_min;
+            }
+            if (window > m_tick_max)
+            {
+                return m_tick_max;
+            }
+            return window;
+        }
+
+    private:
+        tick_t m_tick_min;
+        tick_t m_tick_max;
+        tick_t m_tick_initial;
+        const char *m_path;
+        unsigned m_nUnsaved;
+        tick_t m_tick_saved;
+        entry m_entries[MAX_ENTRIES];
+};
+
+#endif
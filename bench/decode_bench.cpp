@@ -0,0 +1,226 @@
+// @brief: IMPS/2 decoder microbenchmark
+//
+// a capture of aligned packets is decoded by the per packet path of
+// Ps2Reader (sync/ACK check, Imps2Protocol::Decode() to a mouse_report)
+// and by Imps2Batch, both feed the same sums so nothing is optimized
+// away. the sums are checked to be equal, also for a capture with a
+// stray byte in it, and the reports of a replay are checked to be the
+// same through Ps2Reader and Imps2BatchReader. the two are timed in turns, TRIES times, and the
+// best of each counts, so a busy moment hits both alike. exit status is
+// 1 if they differ or the batch decoder is more than MARGIN_PERCENT
+// slower, what two runs of the same code differ by on a loaded box
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "imps2_reader.h"
+#include "ps2_batch.h"
+
+enum {
+    PACKETS = 1 << 16,
+    ROUNDS = 50,
+    TRIES = 9,
+    MARGIN_PERCENT = 5
+};
+
+struct sums
+{
+    long buttons;
+    long status;
+    long x;
+    long y;
+    long z;
+    long packets;
+
+    void Clear()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+};
+
+// Ps2Reader::Next() on a flat buffer
+static void PerPacket(const BYTE *p, unsigned nLen, sums &s)
+{
+    unsigned nPos = 0;
+    while (nPos + Imps2Protocol::SIZE <= nLen)
+    {
+        if (p[nPos] == Ps2Reader<Imps2Protocol>::PS2_ACK || !(p[nPos] & Ps2Reader<Imps2Protocol>::FRAME_SYNC))
+        {
+            nPos++;
+            continue;
+        }
+        mouse_report report;
+        Imps2Protocol::Decode(p + nPos, 0, report);
+        s.buttons += report.btn_left | report.btn_right << 1 | report.btn_middle << 2;
+        s.status += p[nPos] >> 4;
+        s.x += report.x;
+        s.y += report.y;
+        s.z += report.z;
+        s.packets++;
+        nPos += Imps2Protocol::SIZE;
+    }
+}
+
+// Imps2Batch, a byte out of frame is skipped like Ps2Reader does
+static void Batched(const BYTE *p, unsigned nLen, sums &s)
+{
+    static ps2_batch batch;
+    unsigned nPos = 0;
+    while (nPos + Imps2Batch::SIZE <= nLen)
+    {
+        unsigned n = Imps2Batch::Decode(p + nPos, nLen - nPos, batch);
+        if (n == 0)
+        {
+            nPos++;
+            continue;
+        }
+        for (unsigned i = 0; i < n; i++)
+        {
+            s.buttons += batch.buttons[i];
+            s.status += batch.status[i];
+            s.x += batch.x[i];
+            s.y += batch.y[i];
+            s.z += batch.z[i];
+        }
+        s.packets += n;
+        nPos += n * Imps2Batch::SIZE;
+    }
+}
+
+// mousedev packets: sign bits match the deltas, wheel mostly still
+static void Generate(BYTE *p, unsigned nPackets)
+{
+    srand(1);
+    for (unsigned i = 0; i < nPackets; i++)
+    {
+        signed char x = (signed char)(rand() % 255 - 127);
+        signed char y = (signed char)(rand() % 255 - 127);
+        signed char z = (signed char)(rand() % 8 == 0 ? (rand() % 2 ? 1 : -1) : 0);
+        BYTE head = 0x08 | (rand() & 0x07) | (x < 0 ? 0x10 : 0) | (y < 0 ? 0x20 : 0);
+        p[i * 4] = head;
+        p[i * 4 + 1] = x;
+        p[i * 4 + 2] = y;
+        p[i * 4 + 3] = z;
+    }
+}
+
+// the capture as a replay sees it, reads of 1 to CAPTURE_MAX_PAYLOAD
+// bytes with ACKs and bytes out of frame in between, through the scalar
+// and the batch reader. false at the first report that differs
+static bool Replay(const BYTE *capture, unsigned nLen)
+{
+    static BYTE stream[PACKETS * 4 * 2];
+    unsigned nStream = 0;
+    srand(2);
+    for (unsigned nPos = 0; nPos < nLen; nPos += 4)
+    {
+        if (rand() % 64 == 0)
+        {
+            stream[nStream++] = rand() % 2 ? Imps2Batch::PS2_ACK : 0x00;
+        }
+        memcpy(stream + nStream, capture + nPos, 4);
+        nStream += 4;
+    }
+
+    Ps2Reader<Imps2Protocol> scalar(-1);
+    Imps2BatchReader batch;
+    unsigned nReports = 0;
+    for (unsigned nPos = 0; nPos < nStream; )
+    {
+        unsigned n = rand() % 8 ? 1 + rand() % CAPTURE_MAX_PAYLOAD : 1 + rand() % 7;
+        if (n > nStream - nPos)
+        {
+            n = nStream - nPos;
+        }
+        tick_t time = nPos;
+        scalar.Feed(stream + nPos, n);
+        batch.Feed(stream + nPos, n);
+        mouse_report a, b;
+        bool bA, bB;
+        while ((bA = scalar.Next(a, time)) | (bB = batch.Next(b, time)))
+        {
+            if (bA != bB || a.btn_left != b.btn_left || a.btn_right != b.btn_right ||
+                a.btn_middle != b.btn_middle || a.btn_side != b.btn_side || a.btn_extra != b.btn_extra ||
+                a.x != b.x || a.y != b.y || a.z != b.z ||
+                a.z_hires != b.z_hires || a.w_hires != b.w_hires || a.time != b.time)
+            {
+                printf("replay: report %u differs\n", nReports);
+                return false;
+            }
+            nReports++;
+        }
+        nPos += n;
+    }
+    return nReports != 0;
+}
+
+// one try, time per packet in ns, best kept in best (0 is none yet)
+static void Run(void (*decode)(const BYTE *, unsigned, sums &), const BYTE *p, unsigned nLen, sums &s, double &best)
+{
+    s.Clear();
+    tick_t start = NowTick();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        decode(p, nLen, s);
+    }
+    double ns = (double)(NowTick() - start) * 1000.0 / ((double)ROUNDS * PACKETS);
+    if (best == 0 || ns < best)
+    {
+        best = ns;
+    }
+}
+
+int main()
+{
+    static BYTE capture[PACKETS * 4 + 1];
+    Generate(capture, PACKETS);
+
+    // a stray byte half way, both paths resync on the next head
+    static BYTE stray[PACKETS * 4 + 1];
+    unsigned nHalf = PACKETS / 2 * 4;
+    memcpy(stray, capture, nHalf);
+    stray[nHalf] = 0x00;
+    memcpy(stray + nHalf + 1, capture + nHalf, PACKETS * 4 - nHalf);
+
+    sums a, b;
+    a.Clear();
+    b.Clear();
+    PerPacket(stray, sizeof(stray), a);
+    Batched(stray, sizeof(stray), b);
+    if (memcmp(&a, &b, sizeof(sums)) != 0)
+    {
+        printf("stray byte: decoders differ, %ld/%ld packets\n", a.packets, b.packets);
+        return 1;
+    }
+
+    if (!Replay(capture, PACKETS * 4))
+    {
+        return 1;
+    }
+
+    double packet_ns = 0, batch_ns = 0;
+    for (int t = 0; t < TRIES; t++)
+    {
+        Run(PerPacket, capture, PACKETS * 4, a, packet_ns);
+        Run(Batched, capture, PACKETS * 4, b, batch_ns);
+    }
+    if (memcmp(&a, &b, sizeof(sums)) != 0)
+    {
+        printf("decoders differ\n");
+        return 1;
+    }
+
+    printf("packets %d, x %ld y %ld z %ld\n", PACKETS, a.x, a.y, a.z);
+    printf("per packet    %6.2f ns/packet\n", packet_ns);
+    printf("batch (%s)  %6.2f ns/packet\n", Imps2Batch::Path(), batch_ns);
+    if (batch_ns > packet_ns * (100 + MARGIN_PERCENT) / 100)
+    {
+        printf("batch decoder slower than per packet by more than %d%%\n", (int)MARGIN_PERCENT);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,491 @@
+// @brief: gesture matcher microbenchmark
+//
+// the same report stream goes through the old hand-written branches, the
+// table compiled at startup (GestureTable) and the table compiled by the
+// compiler (StaticGestureTable). timerfd and output are left out, only the
+// decision logic is timed. the tables are checked to be equal first and
+// the matchers to send the same actions.
+// the branches ignore release reports, the tables take them as edges, so
+// a stream of nothing but clicks costs the tables more: two lookups per
+// click where the branches do one.
+// the bar is parity: exit status is 1 if either table is more than
+// NOISE_PERCENT slower than the branches on either stream. the clicks
+// only stream does not meet it today (about 40% slower), the bench says
+// so rather than hide it
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "gesture_table.h"
+#include "gesture_spec.h"
+
+enum {
+    REPORTS = 1 << 16,
+    ROUNDS = 50,
+    TRIES = 9,
+    WINDOW_TICKS = 300 * TICKS_PER_MS,
+    // best of TRIES in turns still differs this much between runs
+    NOISE_PERCENT = 5
+};
+
+static const tick_t TICK_NEVER = INT64_MAX;
+
+// counts per action code
+struct sink
+{
+    unsigned count[128];
+    unsigned quit;
+
+    void Clear()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void Emit(char code)
+    {
+        count[code & 0x7f]++;
+    }
+};
+
+// ButtonProcess and ProcessReport before the gesture table
+class LegacyMatcher
+{
+    public:
+        enum { BUTTON_LEFT, BUTTON_RIGHT, BUTTON_NULL };
+
+    public:
+        LegacyMatcher(sink &out)
+        :m_out(out),
+        m_btnPre(BUTTON_NULL),
+        m_bTimer(false),
+        m_tick_deadline(0)
+        {
+        }
+
+        void Report(const mouse_report &report)
+        {
+            Timer(report.time);
+            if (report.z == 0 && report.x == 0 && report.y == 0)
+            {
+                if (report.btn_left)
+                {
+                    Button(BUTTON_LEFT, report.time);
+                }
+                else if (report.btn_right)
+                {
+                    Button(BUTTON_RIGHT, report.time);
+                }
+                else if (report.btn_middle)
+                {
+                    m_out.Emit('p');
+                }
+            }
+            else if (report.z != 0)
+            {
+                m_out.Emit(report.z > 0 ? '9' : '0');
+            }
+        }
+
+        void Timer(tick_t now)
+        {
+            if (m_bTimer && now >= m_tick_deadline)
+            {
+                m_bTimer = false;
+                m_out.Emit(m_btnPre == BUTTON_LEFT ? '<' : '>');
+                m_btnPre = BUTTON_NULL;
+            }
+        }
+
+    private:
+        void Button(int type, tick_t now)
+        {
+            if (m_btnPre == BUTTON_NULL)
+            {
+                m_btnPre = type;
+                m_bTimer = true;
+                m_tick_deadline = now + WINDOW_TICKS;
+            }
+            else if (m_btnPre != type)
+            {
+                m_out.Emit('q');
+                m_out.quit++;
+                m_btnPre = BUTTON_NULL;
+                m_bTimer = false;
+            }
+            else
+            {
+                m_out.Emit(m_btnPre == BUTTON_LEFT ? 'z' : 'x');
+                m_btnPre = BUTTON_NULL;
+                m_bTimer = false;
+            }
+        }
+
+    private:
+        sink &m_out;
+        int m_btnPre;
+        bool m_bTimer;
+        tick_t m_tick_deadline;
+};
+
+// ButtonProcess::Report() and Input() on table T
+template <class T>
+class TableMatcher
+{
+    public:
+        TableMatcher(const T &table, sink &out)
+        :m_table(table),
+        m_out(out),
+        m_nState(GestureTable::STATE_IDLE),
+        m_nButtons(0),
+        m_tick_deadline(TICK_NEVER),
+        m_tick_click(0)
+        {
+        }
+
+        void Report(const mouse_report &report)
+        {
+            Timer(report.time);
+
+            int nButtons = (report.btn_left ? 1 << GestureTable::BUTTON_LEFT : 0) |
+                (report.btn_right ? 1 << GestureTable::BUTTON_RIGHT : 0) |
+                (report.btn_middle ? 1 << GestureTable::BUTTON_MIDDLE : 0);
+            for (int nChanged = nButtons ^ m_nButtons; nChanged; nChanged &= nChanged - 1)
+            {
+                int b = __builtin_ctz(nChanged);
+                m_nButtons ^= 1 << b;
+                Input(((nButtons >> b) & 1) ? GestureTable::SYM_DOWN + b :
+                        GestureTable::SYM_UP + b, report.time);
+            }
+            if (report.z != 0)
+            {
+                Input(report.z > 0 ? GestureTable::SYM_WHEEL_DOWN : GestureTable::SYM_WHEEL_UP, report.time);
+            }
+        }
+
+        void Timer(tick_t now)
+        {
+            if (now >= m_tick_deadline)
+            {
+                Input(GestureTable::SYM_TIMEOUT, now);
+            }
+        }
+
+    private:
+        bool Input(int sym, tick_t now)
+        {
+            const GestureTable::transition &t = m_table.Lookup(m_nState, sym);
+            if (t.flags == 0)
+            {
+                m_nState = t.next;
+            }
+            else
+            {
+                if (t.flags & GestureTable::FLAG_PRESS)
+                {
+                    m_tick_click = now;
+                }
+                if (!(t.flags & GestureTable::FLAG_ALL_UP) || m_nButtons == 0)
+                {
+                    m_nState = t.next;
+                }
+            }
+
+            switch (t.timer)
+            {
+                case GestureTable::TIMER_OFF:
+                    m_tick_deadline = TICK_NEVER;
+                    break;
+                case GestureTable::TIMER_CLICK:
+                    m_tick_deadline = m_tick_click + WINDOW_TICKS;
+                    break;
+                case GestureTable::TIMER_LONG:
+                    m_tick_deadline = m_tick_click + m_table.LongTicks();
+                    break;
+            }
+
+            for (int i = 0; i < GestureTable::OUT_SIZE - 1 && t.out[i]; i++)
+            {
+                m_out.Emit(t.out[i]);
+            }
+
+            if (t.flags & GestureTable::FLAG_QUIT)
+            {
+                m_out.quit++;
+                m_nState = GestureTable::STATE_IDLE;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        const T &m_table;
+        sink &m_out;
+        int m_nState;
+        int m_nButtons;
+        // TICK_NEVER while no click is pending
+        tick_t m_tick_deadline;
+        tick_t m_tick_click;
+};
+
+// clicks, double clicks, left+right, middle and wheel spins. a press
+// report has no motion and the release report is all zero, the old
+// branches and the edges agree on such a stream. with bMotion the pauses
+// are filled with motion reports at 125 Hz like a real mouse, else
+// buttons and wheel come back to back
+static void Generate(mouse_report *reports, int nCount, bool bMotion)
+{
+    srand(1);
+    tick_t now = TICKS_PER_SEC;
+    int i = 0;
+    while (i < nCount - 2)
+    {
+        mouse_report &r = reports[i];
+        memset(&r, 0, sizeof(r));
+        int n = rand() % 8;
+        if (n < 3)
+        {
+            r.btn_left = n != 1;
+            r.btn_right = n == 1;
+        }
+        else if (n == 3)
+        {
+            r.btn_right = true;
+        }
+        else if (n == 4)
+        {
+            r.btn_middle = true;
+        }
+        else
+        {
+            r.z = n == 5 ? 1 : -1;
+        }
+        r.time = now;
+        now += 5 * TICKS_PER_MS;
+        i++;
+
+        if (r.btn_left || r.btn_right || r.btn_middle)
+        {
+            // release
+            memset(&reports[i], 0, sizeof(reports[i]));
+            reports[i].time = now;
+            i++;
+        }
+
+        tick_t end = now + (rand() % 500) * TICKS_PER_MS;
+        while (bMotion && i < nCount - 2 && now + 8 * TICKS_PER_MS < end)
+        {
+            now += 8 * TICKS_PER_MS;
+            memset(&reports[i], 0, sizeof(reports[i]));
+            reports[i].x = rand() % 7 - 3;
+            reports[i].y = rand() % 7 - 3;
+            reports[i].time = now;
+            i++;
+        }
+        now = end;
+    }
+    for (; i < nCount; i++)
+    {
+        memset(&reports[i], 0, sizeof(reports[i]));
+        reports[i].time = now;
+    }
+}
+
+// time per report in ns of one try
+template <class M>
+static double Run(M &matcher, const mouse_report *reports, int nCount)
+{
+    tick_t start = NowTick();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < nCount; i++)
+        {
+            matcher.Report(reports[i]);
+        }
+    }
+    return (double)(NowTick() - start) * 1000.0 / ((double)ROUNDS * nCount);
+}
+
+static void Best(double &best, double ns, int t)
+{
+    if (t == 0 || ns < best)
+    {
+        best = ns;
+    }
+}
+
+template <class S>
+static bool Same(const GestureTable &table, const char *name)
+{
+    StaticGestureTable<S> fixed;
+    for (int s = 0; s < GestureTable::STATES; s++)
+    {
+        for (int sym = 0; sym < GestureTable::SYMBOLS; sym++)
+        {
+            const GestureTable::transition &a = table.Lookup(s, sym);
+            const GestureTable::transition &b = fixed.Lookup(s, sym);
+            if (a.next != b.next || a.timer != b.timer || a.flags != b.flags || strcmp(a.out, b.out) != 0)
+            {
+                printf("%s: state %d symbol %d differs: %d/%d %d/%d %d/%d \"%s\"/\"%s\"\n", name, s, sym,
+                        a.next, b.next, a.timer, b.timer, a.flags, b.flags, a.out, b.out);
+                return false;
+            }
+        }
+    }
+    if (table.LongTicks() != fixed.LongTicks())
+    {
+        printf("%s: long press time differs\n", name);
+        return false;
+    }
+    for (int i = 0; i < GestureTable::SCROLLS; i++)
+    {
+        if (table.Scroll(i) != fixed.Scroll(i))
+        {
+            printf("%s: scroll code %d differs\n", name, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+struct ResolveGestures : DefaultGestures
+{
+    enum {
+        SPECULATIVE = 1 << GestureTable::BUTTON_LEFT | 1 << GestureTable::BUTTON_RIGHT,
+        MOTION_RESOLVE = 10
+    };
+};
+
+struct RichGestures : GestureSpec
+{
+    enum {
+        CLICK_LEFT = 'a', DOUBLE_LEFT = 'b', TRIPLE_LEFT = 'c', LONG_LEFT = 'L',
+        PRESS_RIGHT = '(', RELEASE_RIGHT = ')', DOUBLE_RIGHT = 'x', UPGRADE_RIGHT = 'X',
+        LONG_MIDDLE = 'M', CHORD_LEFT_MIDDLE = 'Q' | GESTURE_QUIT,
+        WHEEL_UP = 'u',
+        SPECULATIVE = 1 << GestureTable::BUTTON_RIGHT,
+        LONG_MS = 450
+    };
+};
+
+static const char rich_config[] =
+    "click left a\n"
+    "double left b\n"
+    "triple left c\n"
+    "long left L\n"
+    "press right (\n"
+    "release right )\n"
+    "double right x\n"
+    "upgrade right X\n"
+    "long middle M\n"
+    "chord middle left Q quit\n"
+    "wheel up u\n"
+    "longtime 450\n";
+
+// the compiler and GestureTable::Compile() build the same tables
+static bool Check()
+{
+    bool none[GestureTable::BUTTONS] = { false, false, false };
+    bool lr[GestureTable::BUTTONS] = { true, true, false };
+    bool r[GestureTable::BUTTONS] = { false, true, false };
+
+    GestureTable table;
+    table.Default();
+    table.Compile(none, false);
+    if (!Same<DefaultGestures>(table, "default"))
+    {
+        return false;
+    }
+    table.Compile(lr, true);
+    if (!Same<ResolveGestures>(table, "speculative, resolve"))
+    {
+        return false;
+    }
+
+    char path[] = "/tmp/gesture_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        return false;
+    }
+    bool bWrite = write(fd, rich_config, sizeof(rich_config) - 1) == (ssize_t)sizeof(rich_config) - 1;
+    close(fd);
+    bool bLoad = bWrite && table.Load(path);
+    unlink(path);
+    if (!bLoad)
+    {
+        printf("config: load fail\n");
+        return false;
+    }
+    table.Compile(r, false);
+    return Same<RichGestures>(table, "config");
+}
+
+// one stream through the three matchers, false if their actions differ
+// or a table is more than nPercent slower than the branches
+static bool Stream(const char *name, bool bMotion, int nPercent)
+{
+    static mouse_report reports[REPORTS];
+    Generate(reports, REPORTS, bMotion);
+
+    bool none[GestureTable::BUTTONS] = { false, false, false };
+    GestureTable table;
+    table.Default();
+    table.Compile(none, false);
+    StaticGestureTable<DefaultGestures> fixed;
+
+    sink legacy_out, table_out, fixed_out;
+    legacy_out.Clear();
+    table_out.Clear();
+    fixed_out.Clear();
+    LegacyMatcher legacy(legacy_out);
+    TableMatcher<GestureTable> runtime(table, table_out);
+    TableMatcher<StaticGestureTable<DefaultGestures> > compiled(fixed, fixed_out);
+
+    // tries take turns, so a slow spell of the machine hits all of them
+    double legacy_ns = 0, table_ns = 0, fixed_ns = 0;
+    for (int t = 0; t < TRIES; t++)
+    {
+        Best(legacy_ns, Run(legacy, reports, REPORTS), t);
+        Best(table_ns, Run(runtime, reports, REPORTS), t);
+        Best(fixed_ns, Run(compiled, reports, REPORTS), t);
+    }
+
+    if (memcmp(&legacy_out, &table_out, sizeof(sink)) != 0 ||
+        memcmp(&legacy_out, &fixed_out, sizeof(sink)) != 0)
+    {
+        printf("%s: matchers send different actions\n", name);
+        return false;
+    }
+
+    printf("%s: reports %d, actions z %u x %u < %u > %u p %u 9 %u 0 %u q %u\n", name, REPORTS,
+            legacy_out.count['z'], legacy_out.count['x'], legacy_out.count['<'], legacy_out.count['>'],
+            legacy_out.count['p'], legacy_out.count['9'], legacy_out.count['0'], legacy_out.quit);
+    printf("    branches      %6.2f ns/report\n", legacy_ns);
+    printf("    GestureTable  %6.2f ns/report\n", table_ns);
+    printf("    static table  %6.2f ns/report\n", fixed_ns);
+
+    double limit = legacy_ns * (100 + nPercent) / 100;
+    if (table_ns > limit || fixed_ns > limit)
+    {
+        printf("%s: a table is more than %d%% slower than the branches\n", name, nPercent);
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    if (!Check())
+    {
+        return 1;
+    }
+
+    bool bClicks = Stream("clicks only", false, NOISE_PERCENT);
+    bool bMotion = Stream("with motion", true, NOISE_PERCENT);
+    return bClicks && bMotion ? 0 : 1;
+}
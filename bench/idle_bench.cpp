@@ -0,0 +1,290 @@
+// @brief: what the capture loop costs while nobody touches the mouse
+//
+// three loops sit on an evdev source that never sends anything:
+//    polling   DeviceManager and Output in an epoll loop with a 20 ms
+//              timeout, the select() loop mouse_capture started with
+//    deadline  the same loop without timeout, timer fds are armed only
+//              while a click is pending, what mouse_capture does now
+//    binary    mouse_capture itself, -e on the idle pipe
+// each runs in a child, after a settle time its voluntary and involuntary
+// context switches (/proc/<pid>/status) and CPU time (/proc/<pid>/schedstat
+// in ns, /proc/<pid>/stat in clock ticks without it) are sampled over the
+// period. the loops count their epoll returns, for the binary every
+// voluntary switch is a wakeup. per second and per idle hour figures go
+// to stdout. exit status is 1 if the deadline loop or the binary wake up
+// more than MAX_WAKEUPS times a second, or if polling does not wake up
+// more than deadline (the measurement is broken then)
+//
+//    idle_bench [mouse_capture [seconds]]
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "mono_tick.h"
+#include "output.h"
+#include "device_manager.h"
+
+enum {
+    PERIOD_SEC = 2,
+    SETTLE_MS = 300,
+    POLL_MS = 20,
+    // a stray signal or timer a second at most
+    MAX_WAKEUPS = 1
+};
+
+struct sample
+{
+    tick_t time;
+    unsigned long voluntary;
+    unsigned long involuntary;
+    double cpu_ms;
+};
+
+struct idle_result
+{
+    const char *loop;
+    double seconds;
+    double wakeups;
+    double voluntary;
+    double involuntary;
+    double cpu_ms;
+};
+
+// epoll returns of the loop children, shared with the parent
+static unsigned long *s_pWakeups = NULL;
+
+static bool Sample(pid_t pid, sample &s)
+{
+    s.time = NowTick();
+
+    char path[64];
+    char buf[2048];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    s.voluntary = 0;
+    s.involuntary = 0;
+    while (fgets(buf, sizeof(buf), fp))
+    {
+        sscanf(buf, "voluntary_ctxt_switches: %lu", &s.voluntary);
+        sscanf(buf, "nonvoluntary_ctxt_switches: %lu", &s.involuntary);
+    }
+    fclose(fp);
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    size_t nLen = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[nLen] = '\0';
+
+    // the name may hold spaces, fields count from its closing parenthesis:
+    // state is field 3, utime 14 and stime 15
+    char *p = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                &utime, &stime) != 2)
+    {
+        return false;
+    }
+    s.cpu_ms = (double)(utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+
+    // the clock tick is 10 ms, a loop that sleeps uses less in a period
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)pid);
+    fp = fopen(path, "r");
+    if (fp != NULL)
+    {
+        unsigned long long ns;
+        if (fscanf(fp, "%llu", &ns) == 1)
+        {
+            s.cpu_ms = (double)ns / 1e6;
+        }
+        fclose(fp);
+    }
+    return true;
+}
+
+// the capture loop of mouse_capture on an idle evdev pipe, until killed
+static void Loop(int timeout, int fd)
+{
+    int epoll_fd = epoll_create(8);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (epoll_fd == -1 || null_fd == -1)
+    {
+        _exit(1);
+    }
+
+#ifdef STATIC_GESTURES
+    gesture_table_t gestures;
+#else
+    GestureTable gestures;
+    bool none[GestureTable::BUTTONS] = { false, false, false };
+    gestures.Default();
+    gestures.Compile(none, false);
+#endif
+    button_config config(&gestures);
+
+    Output output(null_fd);
+    output.Setup(epoll_fd);
+    DeviceManager devices(output, config);
+    devices.Setup(epoll_fd, false);
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    if (!devices.Add(path))
+    {
+        _exit(1);
+    }
+
+    while (true)
+    {
+        struct epoll_event events[8];
+        int ret = epoll_wait(epoll_fd, events, 8, timeout);
+        (*s_pWakeups)++;
+        for (int i = 0; i < ret; i++)
+        {
+            if (devices.Owns(events[i].data.fd))
+            {
+                devices.Event(events[i].data.fd);
+            }
+        }
+        output.Flush();
+    }
+}
+
+// run a loop (binary NULL) or mouse_capture in a child on an idle pipe,
+// measure seconds of it after the settle time
+static bool Measure(const char *loop, int timeout, const char *binary, double seconds, idle_result &r)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        return false;
+    }
+    *s_pWakeups = 0;
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[1]);
+        if (binary == NULL)
+        {
+            Loop(timeout, fds[0]);
+        }
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/fd/%d", fds[0]);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execl(binary, binary, "-e", path, (char *)NULL);
+        _exit(1);
+    }
+    // the write end stays open, the source is idle but not gone
+    close(fds[0]);
+
+    struct timespec settle = { 0, SETTLE_MS * 1000000L };
+    nanosleep(&settle, NULL);
+    sample start, end;
+    unsigned long nStart = *s_pWakeups;
+    bool bOk = Sample(pid, start);
+    struct timespec period;
+    period.tv_sec = (time_t)seconds;
+    period.tv_nsec = (long)((seconds - (double)period.tv_sec) * 1e9);
+    nanosleep(&period, NULL);
+    unsigned long nEnd = *s_pWakeups;
+    bOk = Sample(pid, end) && bOk;
+
+    kill(pid, SIGTERM);
+    int status;
+    waitpid(pid, &status, 0);
+    close(fds[1]);
+    if (!bOk)
+    {
+        fprintf(stderr, "%s: the child is gone\n", loop);
+        return false;
+    }
+
+    r.loop = loop;
+    r.seconds = (double)(end.time - start.time) / TICKS_PER_SEC;
+    r.voluntary = (double)(end.voluntary - start.voluntary) / r.seconds;
+    r.involuntary = (double)(end.involuntary - start.involuntary) / r.seconds;
+    r.wakeups = binary ? r.voluntary : (double)(nEnd - nStart) / r.seconds;
+    r.cpu_ms = (end.cpu_ms - start.cpu_ms) / r.seconds;
+    return true;
+}
+
+static void Print(const idle_result &r)
+{
+    printf("%-8s %8.1f wakeups/s %8.1f vol/s %6.1f invol/s %7.3f ms cpu/s | per idle hour: %8.0f wakeups %8.0f ms cpu\n",
+            r.loop, r.wakeups, r.voluntary, r.involuntary, r.cpu_ms, r.wakeups * 3600, r.cpu_ms * 3600);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *binary = argc > 1 ? argv[1] : NULL;
+    double seconds = argc > 2 ? atof(argv[2]) : (double)PERIOD_SEC;
+    if (seconds <= 0)
+    {
+        fprintf(stderr, "usage: %s [mouse_capture [seconds]]\n", argv[0]);
+        return 1;
+    }
+
+    void *p = mmap(NULL, sizeof(*s_pWakeups), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        return 1;
+    }
+    s_pWakeups = (unsigned long *)p;
+
+    idle_result polling, deadline, bin;
+    if (!Measure("polling", POLL_MS, NULL, seconds, polling) ||
+        !Measure("deadline", -1, NULL, seconds, deadline))
+    {
+        return 1;
+    }
+    Print(polling);
+    Print(deadline);
+
+    bool bOk = true;
+    if (binary)
+    {
+        if (!Measure("binary", -1, binary, seconds, bin))
+        {
+            return 1;
+        }
+        Print(bin);
+        if (bin.wakeups > MAX_WAKEUPS)
+        {
+            fprintf(stderr, "%s wakes up %.1f times/s idle, at most %d\n", binary, bin.wakeups, (int)MAX_WAKEUPS);
+            bOk = false;
+        }
+    }
+    if (deadline.wakeups > MAX_WAKEUPS)
+    {
+        fprintf(stderr, "deadline loop wakes up %.1f times/s idle, at most %d\n", deadline.wakeups, (int)MAX_WAKEUPS);
+        bOk = false;
+    }
+    if (polling.wakeups <= deadline.wakeups)
+    {
+        fprintf(stderr, "polling loop does not wake up more than deadline, measurement broken\n");
+        bOk = false;
+    }
+    return bOk ? 0 : 1;
+}
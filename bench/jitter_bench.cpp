@@ -0,0 +1,162 @@
+// @brief: timer lateness with and without the realtime mode (realtime.h)
+//
+// the gesture timer is a CLOCK_MONOTONIC timerfd in an epoll loop, a
+// click comes out when it fires. here the same timer is armed at an
+// absolute deadline a few ms ahead, over and over, while busy children
+// (the audio decoder) spin on the same CPU, and how late epoll returns
+// goes into a latency histogram: first as a normal process, then after
+// Realtime::Enter(). without permission for SCHED_FIFO (root,
+// CAP_SYS_NICE or RLIMIT_RTPRIO) the second run is skipped
+//
+//    jitter_bench [timers [priority]]
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "mono_tick.h"
+#include "deadline_alarm.h"
+#include "latency_stats.h"
+#include "realtime.h"
+
+enum {
+    TIMERS = 500,
+    INTERVAL_TICKS = 2 * TICKS_PER_MS,
+    SPINNERS = 2,
+    CPU = 0
+};
+
+// competitors, SCHED_OTHER on our CPU until killed
+static bool Spin(pid_t *pids)
+{
+    for (int i = 0; i < SPINNERS; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == -1)
+        {
+            return false;
+        }
+        if (pids[i] == 0)
+        {
+            volatile unsigned long n = 0;
+            while (true)
+            {
+                n++;
+            }
+        }
+    }
+    return true;
+}
+
+static void Stop(pid_t *pids)
+{
+    for (int i = 0; i < SPINNERS; i++)
+    {
+        if (pids[i] > 0)
+        {
+            kill(pids[i], SIGKILL);
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+}
+
+// nTimers deadlines one after the other, lateness of each to hist
+static bool Run(unsigned nTimers, LogLinearHistogram &hist)
+{
+    int epoll_fd = epoll_create(1);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (epoll_fd == -1 || timer_fd == -1)
+    {
+        return false;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    TimerFdAlarm alarm(timer_fd);
+    for (unsigned i = 0; i < nTimers; i++)
+    {
+        // not a multiple of the tick, so the deadlines do not line up
+        tick_t deadline = NowTick() + INTERVAL_TICKS + (i * 37) % 500;
+        alarm.Set(deadline);
+        struct epoll_event events[1];
+        while (epoll_wait(epoll_fd, events, 1, -1) != 1)
+        {
+        }
+        hist.Record(NowTick() - deadline);
+        uint64_t expirations;
+        if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        {
+            return false;
+        }
+    }
+    close(timer_fd);
+    close(epoll_fd);
+    return true;
+}
+
+static void Print(const char *name, LogLinearHistogram &h)
+{
+    printf("%-9s %u timers, late us: p50 %u p90 %u p99 %u p99.9 %u max %u\n", name, h.Total(),
+            h.Percentile(500), h.Percentile(900), h.Percentile(990), h.Percentile(999), h.Max());
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned nTimers = argc > 1 ? (unsigned)atoi(argv[1]) : (unsigned)TIMERS;
+    int nPriority = Realtime::DEFAULT_PRIORITY;
+    int nCpu;
+    if (nTimers == 0 || (argc > 2 && !Realtime::Parse(argv[2], nPriority, nCpu)))
+    {
+        fprintf(stderr, "usage: %s [timers [priority]]\n", argv[0]);
+        return 1;
+    }
+
+    // us and the spinners share one CPU, they inherit the mask
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(CPU, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+        fprintf(stderr, "sched_setaffinity: %s\n", strerror(errno));
+        return 1;
+    }
+    pid_t pids[SPINNERS];
+    memset(pids, 0, sizeof(pids));
+    if (!Spin(pids))
+    {
+        Stop(pids);
+        return 1;
+    }
+
+    LogLinearHistogram normal, realtime;
+    bool bOk = Run(nTimers, normal);
+    if (bOk)
+    {
+        Print("normal", normal);
+        int rt = Realtime::Enter(nPriority, CPU);
+        if (rt != Realtime::RT_OK)
+        {
+            printf("realtime  skipped, %s: %s\n", Realtime::Step(rt), strerror(errno));
+        }
+        else
+        {
+            bOk = Run(nTimers, realtime);
+            if (bOk)
+            {
+                Print("realtime", realtime);
+            }
+        }
+    }
+    Stop(pids);
+    return bOk ? 0 : 1;
+}
@@ -0,0 +1,431 @@
+// @brief: load generator and throughput suite of the decode and gesture path
+//
+// IMPS/2 streams of four mixes (motion heavy, click storms, wheel spins,
+// garbage bytes between the packets) go through Ps2Reader and the gesture
+// logic three ways:
+//    memory  Ps2Reader::Feed() 8 packets at a time, 8 kHz virtual clock
+//    pipe    a child writes the stream as fast as it can, we read it
+//    paced   a child writes one packet every 125 us (8 kHz) for half a
+//            second, we read it as it comes
+// every run reports packets/s, syscalls per packet (reads and alarm
+// settings, the timerfd_settime of a live run), CPU time per packet and
+// operator new calls, and the cost of one latency histogram sample. the
+// result is one JSON object on stdout to compare releases. exit status is
+// 1 if the memory path can not keep 8 kHz, the paths decode different
+// packet counts or the paced run loses packets
+//
+//    load_bench [packets]
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <new>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "imps2_reader.h"
+#include "button_process.h"
+#include "latency_stats.h"
+
+enum {
+    PACKETS = 1 << 18,
+    RATE_HZ = 8000,
+    PERIOD_TICKS = TICKS_PER_SEC / RATE_HZ,
+    PACED_TICKS = TICKS_PER_SEC / 2,
+    MEMORY_CHUNK = 8 * Imps2Protocol::SIZE,
+    PIPE_CHUNK = 4096
+};
+
+enum {
+    MIX_MOTION,
+    MIX_CLICKS,
+    MIX_WHEEL,
+    MIX_GARBAGE,
+    MIXES
+};
+
+static const char *s_mixes[MIXES] = { "motion", "clicks", "wheel", "garbage" };
+
+// operator new calls, the hot path should have none
+static unsigned long s_nAllocs = 0;
+
+void *operator new(size_t nSize)
+{
+    s_nAllocs++;
+    void *p = malloc(nSize ? nSize : 1);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    free(p);
+}
+
+// actions per code
+struct sink
+{
+    unsigned long count[128];
+    unsigned long nActions;
+
+    void Clear()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void Emit(char code, tick_t, int, int n = 1, int = 0)
+    {
+        count[code & 0x7f] += n;
+        nActions++;
+    }
+};
+
+// every Set()/Clear() is one timerfd_settime() live
+struct counting_alarm
+{
+    static unsigned long s_nCalls;
+
+    void Set(tick_t)
+    {
+        s_nCalls++;
+    }
+
+    void Clear()
+    {
+        s_nCalls++;
+    }
+};
+
+unsigned long counting_alarm::s_nCalls = 0;
+
+typedef BasicButtonProcess<counting_alarm, sink> LoadProcess;
+
+struct result
+{
+    const char *mix;
+    const char *path;
+    unsigned long packets;
+    unsigned long actions;
+    double seconds;
+    double pps;
+    double syscalls_per_packet;
+    double cpu_ns_per_packet;
+    unsigned long allocs;
+};
+
+static tick_t CpuTick()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return TimespecToTick(ts);
+}
+
+// IMPS/2 bytes of nPackets packets of mix, return the length
+static unsigned Generate(int mix, BYTE *p, unsigned nPackets)
+{
+    srand(mix + 1);
+    unsigned nLen = 0;
+    bool bDown = false;
+    for (unsigned i = 0; i < nPackets; i++)
+    {
+        signed char x = 0, y = 0, z = 0;
+        BYTE buttons = 0;
+        switch (mix)
+        {
+            case MIX_MOTION:
+                x = (signed char)(rand() % 31 - 15);
+                y = (signed char)(rand() % 31 - 15);
+                // a click now and then
+                bDown = (i % 512) < 8 ? (i % 512) < 4 : false;
+                break;
+            case MIX_CLICKS:
+                // left and right presses, every packet an edge
+                bDown = !bDown;
+                break;
+            case MIX_WHEEL:
+                z = (signed char)(rand() % 3 + 1);
+                z = (i / 256) & 1 ? z : -z;
+                break;
+            case MIX_GARBAGE:
+                x = (signed char)(rand() % 7 - 3);
+                if (rand() % 8 == 0)
+                {
+                    // an ACK or a byte without the sync bit, Ps2Reader skips it
+                    p[nLen++] = rand() % 2 ? 0xfa : (BYTE)(rand() & 0xf7);
+                }
+                break;
+        }
+        if (bDown)
+        {
+            buttons = mix == MIX_CLICKS && (i / 2) % 3 == 2 ? 0x02 : 0x01;
+        }
+        p[nLen++] = 0x08 | buttons | (x < 0 ? 0x10 : 0) | (y < 0 ? 0x20 : 0);
+        p[nLen++] = x;
+        p[nLen++] = y;
+        p[nLen++] = z;
+    }
+    return nLen;
+}
+
+// deadlines due at now, then the reports of the reader
+static unsigned long Drain(Ps2Reader<Imps2Protocol> &reader, LoadProcess &process, tick_t now)
+{
+    tick_t deadline;
+    if (process.NextDeadline(deadline) && deadline <= now)
+    {
+        process.Timer(now);
+    }
+    unsigned long n = 0;
+    mouse_report report;
+    while (reader.Next(report, now))
+    {
+        n++;
+        if (!process.Report(report))
+        {
+            // q, keep going like a restarted daemon
+        }
+    }
+    return n;
+}
+
+static void Start(result &r, int mix, const char *path, tick_t &wall, tick_t &cpu)
+{
+    memset(&r, 0, sizeof(r));
+    r.mix = s_mixes[mix];
+    r.path = path;
+    counting_alarm::s_nCalls = 0;
+    s_nAllocs = 0;
+    wall = NowTick();
+    cpu = CpuTick();
+}
+
+static void Stop(result &r, unsigned long nReads, tick_t wall, tick_t cpu, const sink &out)
+{
+    tick_t elapsed = NowTick() - wall;
+    r.actions = out.nActions;
+    r.allocs = s_nAllocs;
+    r.seconds = (double)elapsed / TICKS_PER_SEC;
+    r.pps = r.packets / (r.seconds > 0 ? r.seconds : 1e-9);
+    r.syscalls_per_packet = r.packets ? (double)(nReads + counting_alarm::s_nCalls) / r.packets : 0;
+    r.cpu_ns_per_packet = r.packets ? (double)(CpuTick() - cpu) * 1000.0 / r.packets : 0;
+}
+
+// the stream in chunks of 8 packets, report times on an 8 kHz clock
+static void Memory(int mix, const BYTE *p, unsigned nLen, const button_config &config, result &r)
+{
+    sink out;
+    out.Clear();
+    LoadProcess process(counting_alarm(), out, 0, config);
+    Ps2Reader<Imps2Protocol> reader(-1);
+
+    tick_t wall, cpu;
+    Start(r, mix, "memory", wall, cpu);
+    tick_t now = 0;
+    unsigned long nFeeds = 0;
+    for (unsigned nPos = 0; nPos < nLen; nPos += MEMORY_CHUNK)
+    {
+        unsigned n = nLen - nPos < (unsigned)MEMORY_CHUNK ? nLen - nPos : (unsigned)MEMORY_CHUNK;
+        reader.Feed(p + nPos, n);
+        now += (tick_t)PERIOD_TICKS * (n / Imps2Protocol::SIZE);
+        r.packets += Drain(reader, process, now);
+        nFeeds++;
+    }
+    // a feed stands for a read of a live run
+    Stop(r, nFeeds, wall, cpu, out);
+}
+
+// a child writes the stream to a pipe, paced to RATE_HZ or as fast as it can
+static bool Pipe(int mix, const BYTE *p, unsigned nLen, bool bPaced, const button_config &config, result &r)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        return false;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        unsigned nPos = 0;
+        tick_t start = NowTick();
+        while (nPos < nLen)
+        {
+            unsigned n = nLen - nPos < (unsigned)PIPE_CHUNK ? nLen - nPos : (unsigned)PIPE_CHUNK;
+            if (bPaced)
+            {
+                // every packet that is due by now, then sleep to the next
+                tick_t elapsed = NowTick() - start;
+                if (elapsed >= PACED_TICKS)
+                {
+                    break;
+                }
+                unsigned nDue = (unsigned)(elapsed / PERIOD_TICKS + 1) * Imps2Protocol::SIZE;
+                n = nDue > nPos ? nDue - nPos : 0;
+                if (n == 0)
+                {
+                    struct timespec ts;
+                    TickToTimespec(start + (tick_t)(nPos / Imps2Protocol::SIZE) * PERIOD_TICKS, ts);
+                    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                    continue;
+                }
+            }
+            ssize_t nWritten = write(fds[1], p + nPos, n);
+            if (nWritten <= 0)
+            {
+                break;
+            }
+            nPos += nWritten;
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    sink out;
+    out.Clear();
+    LoadProcess process(counting_alarm(), out, 0, config);
+    Ps2Reader<Imps2Protocol> reader(fds[0]);
+
+    tick_t wall, cpu;
+    Start(r, mix, bPaced ? "paced" : "pipe", wall, cpu);
+    unsigned long nReads = 0;
+    while (reader.Fill() > 0)
+    {
+        nReads++;
+        r.packets += Drain(reader, process, NowTick());
+    }
+    nReads++;
+    Stop(r, nReads, wall, cpu, out);
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return true;
+}
+
+// ns of one LogLinearHistogram sample
+static double HistogramCost()
+{
+    enum { SAMPLES = 1 << 22 };
+    LogLinearHistogram h;
+    srand(7);
+    uint32_t v = rand();
+    tick_t start = NowTick();
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        // xorshift, spread over every bucket group
+        v ^= v << 13;
+        v ^= v >> 17;
+        v ^= v << 5;
+        h.Record(v >> (v & 31));
+    }
+    tick_t elapsed = NowTick() - start;
+    if (h.Total() != SAMPLES)
+    {
+        return -1;
+    }
+    return (double)elapsed * 1000.0 / SAMPLES;
+}
+
+static void Print(const result &r, bool bLast)
+{
+    printf("    {\"mix\": \"%s\", \"path\": \"%s\", \"packets\": %lu, \"actions\": %lu, "
+            "\"seconds\": %.4f, \"packets_per_sec\": %.0f, \"syscalls_per_packet\": %.4f, "
+            "\"cpu_ns_per_packet\": %.1f, \"allocs\": %lu}%s\n",
+            r.mix, r.path, r.packets, r.actions, r.seconds, r.pps, r.syscalls_per_packet,
+            r.cpu_ns_per_packet, r.allocs, bLast ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned nPackets = argc > 1 ? (unsigned)atoi(argv[1]) : (unsigned)PACKETS;
+    if (nPackets == 0)
+    {
+        fprintf(stderr, "usage: %s [packets]\n", argv[0]);
+        return 1;
+    }
+    // a child that dies early must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+#ifdef STATIC_GESTURES
+    gesture_table_t gestures;
+#else
+    GestureTable gestures;
+    bool none[GestureTable::BUTTONS] = { false, false, false };
+    gestures.Default();
+    gestures.Compile(none, false);
+#endif
+    button_config config(&gestures);
+
+    // a garbage byte every 8 packets at most
+    BYTE *stream = (BYTE *)malloc(nPackets * (Imps2Protocol::SIZE + 1));
+    if (stream == NULL)
+    {
+        return 1;
+    }
+
+    enum { RUNS = MIXES * 2 + 1 };
+    result results[RUNS];
+    int nRuns = 0;
+    bool bOk = true;
+    for (int mix = 0; mix < MIXES; mix++)
+    {
+        unsigned nLen = Generate(mix, stream, nPackets);
+        result &mem = results[nRuns++];
+        result &pipe = results[nRuns++];
+        Memory(mix, stream, nLen, config, mem);
+        if (!Pipe(mix, stream, nLen, false, config, pipe))
+        {
+            return 1;
+        }
+        if (mem.pps < RATE_HZ)
+        {
+            fprintf(stderr, "%s: %.0f packets/s in memory, below %d\n", mem.mix, mem.pps, (int)RATE_HZ);
+            bOk = false;
+        }
+        if (mem.packets != pipe.packets)
+        {
+            fprintf(stderr, "%s: memory decoded %lu packets, pipe %lu\n", mem.mix, mem.packets, pipe.packets);
+            bOk = false;
+        }
+    }
+
+    // the rate of a fast mouse, as it comes
+    unsigned nLen = Generate(MIX_MOTION, stream, nPackets);
+    result &paced = results[nRuns++];
+    if (!Pipe(MIX_MOTION, stream, nLen, true, config, paced))
+    {
+        return 1;
+    }
+    unsigned long nExpect = (unsigned long)PACED_TICKS / PERIOD_TICKS;
+    if (nExpect > nPackets)
+    {
+        nExpect = nPackets;
+    }
+    if (paced.packets + RATE_HZ / 100 < nExpect)
+    {
+        // more than 10 ms worth of packets short
+        fprintf(stderr, "paced: %lu of %lu packets\n", paced.packets, nExpect);
+        bOk = false;
+    }
+    free(stream);
+
+    printf("{\n  \"bench\": \"load\",\n  \"rate_hz\": %d,\n  \"histogram_ns_per_sample\": %.2f,\n  \"runs\": [\n",
+            (int)RATE_HZ, HistogramCost());
+    for (int i = 0; i < nRuns; i++)
+    {
+        Print(results[i], i == nRuns - 1);
+    }
+    printf("  ]\n}\n");
+    return bOk ? 0 : 1;
+}
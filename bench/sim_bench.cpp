@@ -0,0 +1,120 @@
+// @brief: gesture logic on the virtual clock
+//
+// generated clicks (SyntheticMouse) go through the real ButtonProcess
+// logic with a VirtualAlarm, the clock jumps from report to deadline. the
+// double click window is checked to the microsecond: a second press 299 ms
+// after the first is a double click, at 300 and 301 ms it is two single
+// clicks. the same with the learned window on, whose bookkeeping runs on
+// every click and timeout (make check-sanitize runs this under ASan and
+// UBSan). then millions of clicks are timed. exit status is 1 if an edge
+// case gives the wrong actions
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "button_process.h"
+#include "virtual_clock.h"
+#include "synthetic_mouse.h"
+
+enum {
+    GROUPS = 1 << 20,
+    MAX_TEXT = 64
+};
+
+// the first actions as text and counts per code
+struct sink
+{
+    char text[MAX_TEXT];
+    unsigned nLen;
+    unsigned count[128];
+
+    void Clear()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    void Emit(char code, tick_t, int, int n = 1, int = 0)
+    {
+        count[code & 0x7f] += n;
+        if (nLen < sizeof(text) - 1)
+        {
+            text[nLen++] = code;
+        }
+    }
+};
+
+typedef BasicButtonProcess<VirtualAlarm, sink> SimProcess;
+
+// one pair of left clicks gap apart, false if the actions are not expect
+static bool Edge(const button_config &config, tick_t gap, const char *expect)
+{
+    sink out;
+    out.Clear();
+    SimProcess process(VirtualAlarm(), out, 0, config);
+    SyntheticMouse mouse;
+    mouse.Clicks(GestureTable::BUTTON_LEFT, 2, 20 * TICKS_PER_MS, gap, TICKS_PER_SEC, 1);
+    mouse.Rewind(TICKS_PER_SEC);
+    VirtualClock<SyntheticMouse, SimProcess> clock(mouse, process);
+    clock.Run();
+
+    bool bSame = strcmp(out.text, expect) == 0;
+    printf("gap %3lld.%03lld ms: %-4s %s\n", (long long)(gap / TICKS_PER_MS),
+            (long long)(gap % TICKS_PER_MS), out.text, bSame ? "ok" : "expected differently");
+    return bSame;
+}
+
+int main()
+{
+#ifdef STATIC_GESTURES
+    gesture_table_t gestures;
+#else
+    GestureTable gestures;
+    bool none[GestureTable::BUTTONS] = { false, false, false };
+    gestures.Default();
+    gestures.Compile(none, false);
+#endif
+    button_config config(&gestures);
+
+    const tick_t window = SimProcess::DBLCLICK_TICKS;
+    if (!Edge(config, window - TICKS_PER_MS, "z") ||
+        !Edge(config, window - 1, "z") ||
+        !Edge(config, window, "<<") ||
+        !Edge(config, window + TICKS_PER_MS, "<<"))
+    {
+        return 1;
+    }
+
+    // no file, too few samples to move: the window stays where it starts
+    AdaptiveWindow adaptive(100 * TICKS_PER_MS, 600 * TICKS_PER_MS, window, NULL);
+    button_config learned(&gestures);
+    learned.pAdaptive = &adaptive;
+    if (!Edge(learned, window - 1, "z") ||
+        !Edge(learned, window + 50 * TICKS_PER_MS, "<<"))
+    {
+        return 1;
+    }
+
+    // double clicks, a single click and a wheel detent, over and over
+    sink out;
+    out.Clear();
+    SimProcess process(VirtualAlarm(), out, 0, config);
+    SyntheticMouse mouse;
+    mouse.Clicks(GestureTable::BUTTON_LEFT, 3, 30 * TICKS_PER_MS, 150 * TICKS_PER_MS, 700 * TICKS_PER_MS, GROUPS);
+    mouse.Wheel(1);
+    VirtualClock<SyntheticMouse, SimProcess> clock(mouse, process);
+
+    tick_t start = NowTick();
+    clock.Run();
+    tick_t elapsed = NowTick() - start;
+
+    double clicks = (double)GROUPS * 3;
+    printf("%.0f clicks in %lld virtual s: z %u < %u 9 %u\n", clicks,
+            (long long)(clock.Now() / TICKS_PER_SEC), out.count['z'], out.count['<'], out.count['9']);
+    printf("%.2f M clicks/s, %.1f ns/click\n", clicks / (double)elapsed,
+            (double)elapsed * 1000.0 / clicks);
+    return 0;
+}
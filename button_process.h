@@ -0,0 +1,549 @@
+// @brief: gestures of mouse reports, driven by a compiled GestureTable
+//
+// reports are turned into input symbols (press/release edges, wheel,
+// motion, timeout), every symbol is one table lookup that gives the next
+// state, the timer and the action codes to send
+//
+// the deadlines go to an Alarm and the actions to a Sink, both template
+// parameters (deadline_alarm.h), so the same logic runs live on a timerfd
+// and Output, or on a virtual clock (virtual_clock.h)
+//
+// @output: see mouse_capture.cpp
+
+#ifndef BUTTON_PROCESS_H
+#define BUTTON_PROCESS_H
+
+#include <assert.h>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "output.h"
+#include "deadline_alarm.h"
+#include "adaptive_window.h"
+#include "wheel_aggregator.h"
+#include "wheel_accumulator.h"
+#include "gesture_table.h"
+#include "flight_recorder.h"
+#include "trace_writer.h"
+
+#ifdef STATIC_GESTURES
+#include "gesture_spec.h"
+#ifndef GESTURE_SPEC
+#define GESTURE_SPEC DefaultGestures
+#endif
+// bindings fixed at compile time, no config parsing
+typedef StaticGestureTable<GESTURE_SPEC> gesture_table_t;
+#else
+typedef GestureTable gesture_table_t;
+#endif
+
+// gesture settings shared by every ButtonProcess, the defaults are the
+// plain behaviour: no speculation, fixed window, every detent by itself,
+// no fine steps, no recording. set what differs
+struct button_config
+{
+    explicit button_config(const gesture_table_t *gestures = NULL)
+    :motion_resolve(0),
+    pAdaptive(NULL),
+    pGestures(gestures),
+    wheel_window(0),
+    wheel_accel(0),
+    wheel_fine(0),
+    pFlight(NULL),
+    pTrace(NULL)
+    {
+        for (int b = 0; b < GestureTable::BUTTONS; b++)
+        {
+            speculative[b] = false;
+        }
+    }
+
+    // emit the single click at once and upgrade it when the second click
+    // comes, per GestureTable::BUTTON_*
+    bool speculative[GestureTable::BUTTONS];
+
+    // a pending click resolves as single click once the mouse moved this far
+    // (|x| + |y|) or on wheel and other buttons, 0 waits out the window
+    int motion_resolve;
+
+    // learned double click window, NULL is the fixed DBLCLICK_TICKS
+    AdaptiveWindow *pAdaptive;
+
+    // compiled bindings
+    const gesture_table_t *pGestures;
+
+    // wheel detents are summed over this window and sent as one action
+    // with a count, 0 sends every wheel report by itself
+    tick_t wheel_window;
+    // velocity curve, Q8 gain added per detent in one window, 0 is linear
+    int wheel_accel;
+
+    // fine step of high resolution wheels in 1/120 detent, 0 sends none
+    int wheel_fine;
+
+    // reports, transitions and actions for the postmortem, NULL is off
+    FlightRecorder *pFlight;
+
+    // reports, transitions, alarms and actions on a timeline (--trace),
+    // NULL is off
+    TraceWriter *pTrace;
+};
+
+// gesture state of one mouse. Alarm has Set(deadline) and Clear(), Sink
+// has Emit(code, time, dev, count, wheel) like Output
+template <class Alarm, class Sink>
+class BasicButtonProcess
+{
+    public:
+        // double click window
+        enum { DBLCLICK_TICKS = 300 * TICKS_PER_MS };
+
+        enum { WHEEL_V, WHEEL_H, WHEEL_AXES };
+
+    public:
+        // alarm is set only while a click or a wheel window is pending,
+        // dev tags the actions of this source
+        BasicButtonProcess(const Alarm &alarm, Sink &output, int dev, const button_config &config)
+        :m_nState(GestureTable::STATE_IDLE),
+        m_nButtons(0),
+        m_tick_deadline(0),
+        m_bTimer(false),
+        m_alarm(alarm),
+        m_output(output),
+        m_nDev(dev),
+        m_config(config),
+        m_gestures(*config.pGestures),
+        m_pFlight(config.pFlight),
+        m_pTrace(config.pTrace),
+        m_nMotion(0),
+        m_tick_click(0)
+        {
+            for (int i = 0; i < WHEEL_AXES; i++)
+            {
+                m_accum[i].Setup(config.wheel_fine);
+                m_wheel[i].Setup(config.wheel_window, config.wheel_accel);
+            }
+            for (int b = 0; b < GestureTable::BUTTONS; b++)
+            {
+                m_bSingle[b] = false;
+                m_tick_single[b] = 0;
+                m_tick_late[b] = 0;
+                m_tick_late_at[b] = 0;
+            }
+        }
+
+        int Dev()
+        {
+            return m_nDev;
+        }
+
+        // single shot at the deadline of the pending click
+        void EnableTimer(tick_t deadline)
+        {
+            m_bTimer = true;
+            m_tick_deadline = deadline;
+            m_nMotion = 0;
+            Arm();
+        }
+
+        void DisableTimer()
+        {
+            m_bTimer = false;
+            Arm();
+        }
+
+        bool IsTimerEnable()
+        {
+            return m_bTimer;
+        }
+
+        // button and wheel actions of one report, return false to quit
+        bool Report(const mouse_report &report)
+        {
+            //printf("left:%d right:%d middle:%d X:%d Y:%d Z:%d\n",
+            //report.btn_left, report.btn_right, report.btn_middle, report.x, report.y, report.z);
+            if (m_pFlight)
+            {
+                m_pFlight->Record(FlightRecorder::FLIGHT_REPORT, report.time, m_nDev,
+                        report.btn_left | report.btn_right << 1 | report.btn_middle << 2 |
+                        report.btn_side << 3 | report.btn_extra << 4,
+                        report.x, report.y, report.z_hires);
+            }
+            if (m_pTrace)
+            {
+                m_pTrace->Instant(TraceWriter::TRACE_REPORT, m_nDev + 1, report.time,
+                        report.btn_left | report.btn_right << 1 | report.btn_middle << 2 |
+                        report.btn_side << 3 | report.btn_extra << 4,
+                        report.x, report.y, report.z_hires);
+            }
+
+            // window of the pending click closed before this report,
+            // the alarm just was not served yet
+            Timer(report.time);
+
+            if (report.x != 0 || report.y != 0)
+            {
+                Motion(report.x, report.y, report.time);
+            }
+
+            // press and release edges
+            int nButtons = (report.btn_left ? 1 << GestureTable::BUTTON_LEFT : 0) |
+                (report.btn_right ? 1 << GestureTable::BUTTON_RIGHT : 0) |
+                (report.btn_middle ? 1 << GestureTable::BUTTON_MIDDLE : 0);
+            if (nButtons != m_nButtons)
+            {
+                // summed detents go before the button action
+                for (int i = 0; i < WHEEL_AXES; i++)
+                {
+                    if (m_wheel[i].Pending())
+                    {
+                        CloseWheel(i, report.time);
+                    }
+                }
+            }
+            for (int b = 0; b < GestureTable::BUTTONS; b++)
+            {
+                int mask = 1 << b;
+                if ((nButtons ^ m_nButtons) & mask)
+                {
+                    m_nButtons ^= mask;
+                    if (!Input((nButtons & mask) ? GestureTable::SYM_DOWN + b :
+                                GestureTable::SYM_UP + b, report.time))
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            if (report.z_hires != 0 && !Units(WHEEL_V, report.z_hires, report.time))
+            {
+                return false;
+            }
+            if (report.w_hires != 0)
+            {
+                Units(WHEEL_H, report.w_hires, report.time);
+            }
+            return true;
+        }
+
+        // called when the alarm expires
+        void Timer(tick_t now)
+        {
+            for (int i = 0; i < WHEEL_AXES; i++)
+            {
+                if (m_wheel[i].IsOpen() && now >= m_wheel[i].Deadline())
+                {
+                    CloseWheel(i, now);
+                }
+            }
+            if (IsTimerEnable() && now >= m_tick_deadline)
+            {
+                Input(GestureTable::SYM_TIMEOUT, now);
+            }
+        }
+
+        // earliest of the click and the wheel deadlines, false if
+        // nothing is pending
+        bool NextDeadline(tick_t &deadline)
+        {
+            bool bArm = m_bTimer;
+            deadline = m_tick_deadline;
+            for (int i = 0; i < WHEEL_AXES; i++)
+            {
+                if (m_wheel[i].IsOpen() && (!bArm || m_wheel[i].Deadline() < deadline))
+                {
+                    bArm = true;
+                    deadline = m_wheel[i].Deadline();
+                }
+            }
+            return bArm;
+        }
+
+    private:
+        // alarm at the earlier of the click and the wheel deadline
+        void Arm()
+        {
+            tick_t deadline;
+            bool bArm = NextDeadline(deadline);
+            if (bArm)
+            {
+                m_alarm.Set(deadline);
+            }
+            else
+            {
+                m_alarm.Clear();
+            }
+            if (m_pTrace)
+            {
+                tick_t now = NowTick();
+                m_pTrace->Instant(TraceWriter::TRACE_ARM, m_nDev + 1, now, bArm, bArm ? (int32_t)(deadline - now) : 0);
+            }
+        }
+
+        // wheel units of one report on axis, detents and fine steps
+        bool Units(int axis, int units, tick_t now)
+        {
+            int nDetents, nFine;
+            m_accum[axis].Add(units, nDetents, nFine);
+            if (nFine != 0)
+            {
+                // fine steps are not summed, they are already the fine view
+                int i = axis == WHEEL_V ?
+                    (nFine > 0 ? GestureTable::SCROLL_FINE_DOWN : GestureTable::SCROLL_FINE_UP) :
+                    (nFine > 0 ? GestureTable::SCROLL_FINE_RIGHT : GestureTable::SCROLL_FINE_LEFT);
+                char code = m_gestures.Scroll(i);
+                if (code)
+                {
+                    Emit(code, now, Clamp(nFine > 0 ? nFine : -nFine), WheelId(axis, true, nFine));
+                }
+            }
+            if (nDetents == 0)
+            {
+                return true;
+            }
+            return Wheel(axis, nDetents > 0 ? 1 : -1, nDetents > 0 ? nDetents : -nDetents, now);
+        }
+
+        // n detents on axis, dir > 0 rolling down (right)
+        bool Wheel(int axis, int dir, int n, tick_t now)
+        {
+            WheelAggregator &w = m_wheel[axis];
+            if (w.Pending() && dir != w.Dir())
+            {
+                CloseWheel(axis, now);
+            }
+            bool bOpen = w.IsOpen();
+            int nCount = w.Add(dir, n, now);
+            if (w.IsOpen() != bOpen)
+            {
+                Arm();
+            }
+            if (nCount == 0)
+            {
+                return true;
+            }
+            return Detents(axis, dir, nCount, now);
+        }
+
+        // send the summed detents, the window opens again or the wheel is quiet
+        void CloseWheel(int axis, tick_t now)
+        {
+            int nCount = m_wheel[axis].Close(now);
+            if (nCount > 0)
+            {
+                Detents(axis, m_wheel[axis].Dir(), nCount, now);
+            }
+            Arm();
+        }
+
+        // vertical detents are gesture symbols, horizontal ones plain codes
+        bool Detents(int axis, int dir, int count, tick_t now)
+        {
+            if (axis == WHEEL_V)
+            {
+                return Input(dir > 0 ? GestureTable::SYM_WHEEL_DOWN : GestureTable::SYM_WHEEL_UP, now, count);
+            }
+            char code = m_gestures.Scroll(dir > 0 ? GestureTable::SCROLL_RIGHT : GestureTable::SCROLL_LEFT);
+            if (code)
+            {
+                Emit(code, now, count, WheelId(axis, false, dir));
+            }
+            return true;
+        }
+
+        // what the output queue may merge or cancel the action with: 0 a
+        // button action, else 1 + axis for detents, 3 + axis for fine
+        // steps, negative rolling up (left). the code cannot tell, the
+        // table may bind a wheel to a button code and back
+        static int WheelId(int axis, bool bFine, int dir)
+        {
+            int id = 1 + axis + (bFine ? WHEEL_AXES : 0);
+            return dir > 0 ? id : -id;
+        }
+
+        void Emit(char code, tick_t now, int count, int wheel = 0)
+        {
+            if (m_pFlight)
+            {
+                m_pFlight->Record(FlightRecorder::FLIGHT_ACTION, now, m_nDev, code, count);
+            }
+            if (m_pTrace)
+            {
+                // when it was decided, not the event time it was decided on
+                m_pTrace->Instant(TraceWriter::TRACE_ACTION, m_nDev + 1, NowTick(), code, count);
+            }
+            m_output.Emit(code, now, m_nDev, count, wheel);
+        }
+
+        static int Clamp(int n)
+        {
+            return n < WheelAggregator::MAX_COUNT ? n : WheelAggregator::MAX_COUNT;
+        }
+
+        // the user moved away, the pending click will not become a double click
+        void Motion(int x, int y, tick_t now)
+        {
+            if (IsTimerEnable() && m_config.motion_resolve > 0)
+            {
+                m_nMotion += (x < 0 ? -x : x) + (y < 0 ? -y : y);
+                if (m_nMotion >= m_config.motion_resolve)
+                {
+                    Input(GestureTable::SYM_MOTION, now);
+                }
+            }
+        }
+
+        // one symbol, now is its event time. count is the number of wheel
+        // detents it stands for. return false to quit
+        bool Input(int sym, tick_t now, int count = 1)
+        {
+            const GestureTable::transition &t = m_gestures.Lookup(m_nState, sym);
+            int nFrom = m_nState;
+            if (t.flags == 0)
+            {
+                m_nState = t.next;
+            }
+            else
+            {
+                Flags(t.flags, sym, now);
+                if (!(t.flags & GestureTable::FLAG_ALL_UP) || m_nButtons == 0)
+                {
+                    m_nState = t.next;
+                }
+            }
+
+            switch (t.timer)
+            {
+                case GestureTable::TIMER_OFF:
+                    DisableTimer();
+                    break;
+                case GestureTable::TIMER_CLICK:
+                    // window starts at the click time, not when we got to process it
+                    EnableTimer(m_tick_click + (m_config.pAdaptive ?
+                            m_config.pAdaptive->Window(m_nDev, GestureTable::Button(m_nState)) :
+                            DBLCLICK_TICKS));
+                    break;
+                case GestureTable::TIMER_LONG:
+                    EnableTimer(m_tick_click + m_gestures.LongTicks());
+                    break;
+            }
+            if (m_pFlight)
+            {
+                m_pFlight->Record(FlightRecorder::FLIGHT_STATE, now, m_nDev, sym, nFrom, m_nState, t.timer);
+            }
+            if (m_pTrace)
+            {
+                m_pTrace->Instant(TraceWriter::TRACE_STATE, m_nDev + 1, now, sym, nFrom, m_nState, t.timer);
+            }
+
+            // a wheel symbol's action is the last, a resolved click comes first
+            int wheel = sym == GestureTable::SYM_WHEEL_DOWN ? WheelId(WHEEL_V, false, 1) :
+                sym == GestureTable::SYM_WHEEL_UP ? WheelId(WHEEL_V, false, -1) : 0;
+            for (int i = 0; i < GestureTable::OUT_SIZE - 1 && t.out[i]; i++)
+            {
+                if (t.out[i + 1])
+                {
+                    Emit(t.out[i], now, 1);
+                }
+                else
+                {
+                    Emit(t.out[i], now, count, wheel);
+                }
+            }
+
+            if (t.flags & GestureTable::FLAG_QUIT)
+            {
+                if (m_pFlight)
+                {
+                    m_pFlight->Record(FlightRecorder::FLIGHT_QUIT, now, m_nDev, 0);
+                }
+                m_nState = GestureTable::STATE_IDLE;
+                DisableTimer();
+                return false;
+            }
+            return true;
+        }
+
+        // click times and adaptive window samples
+        void Flags(int flags, int sym, tick_t now)
+        {
+            if (flags & GestureTable::FLAG_SINGLE)
+            {
+                // remember it, the second click may just be late
+                int b = GestureTable::Button(m_nState);
+                m_bSingle[b] = true;
+                m_tick_single[b] = m_tick_click;
+            }
+
+            // the others come with a press, b is a button for SYM_DOWN + b only
+            int b = sym - GestureTable::SYM_DOWN;
+            if (m_config.pAdaptive && b >= 0 && b < GestureTable::BUTTONS)
+            {
+                if (flags & GestureTable::FLAG_FIRST)
+                {
+                    if (m_bSingle[b] && m_tick_late[b] == 0 &&
+                        now - m_tick_single[b] <= m_config.pAdaptive->Max())
+                    {
+                        // maybe a double click the window was too short for, or
+                        // two single clicks. only a double click right after
+                        // (the user tried again) tells
+                        m_tick_late[b] = now - m_tick_single[b];
+                        m_tick_late_at[b] = now;
+                    }
+                    m_bSingle[b] = false;
+                }
+                if (flags & GestureTable::FLAG_SAMPLE)
+                {
+                    if (m_tick_late[b] != 0 && now - m_tick_late_at[b] <= AdaptiveWindow::RETRY_TICKS)
+                    {
+                        m_config.pAdaptive->Sample(m_nDev, b, m_tick_late[b]);
+                    }
+                    m_tick_late[b] = 0;
+                    m_config.pAdaptive->Sample(m_nDev, b, now - m_tick_click);
+                }
+                if (m_tick_late[b] != 0 && now - m_tick_late_at[b] > AdaptiveWindow::RETRY_TICKS)
+                {
+                    // no retry, they were single clicks
+                    m_tick_late[b] = 0;
+                }
+            }
+            if (flags & GestureTable::FLAG_PRESS)
+            {
+                m_tick_click = now;
+            }
+        }
+
+    private:
+        int m_nState;
+        // buttons held, bit per GestureTable::BUTTON_*
+        int m_nButtons;
+        // deadline of the pending click
+        tick_t m_tick_deadline;
+        bool m_bTimer;
+        Alarm m_alarm;
+        Sink &m_output;
+        int m_nDev;
+        const button_config &m_config;
+        const gesture_table_t &m_gestures;
+        FlightRecorder *m_pFlight;
+        TraceWriter *m_pTrace;
+        // motion since the timer was armed
+        int m_nMotion;
+        // per WHEEL_*
+        WheelAccumulator m_accum[WHEEL_AXES];
+        WheelAggregator m_wheel[WHEEL_AXES];
+
+        // time of the last press
+        tick_t m_tick_click;
+        // last single click per button that timed out
+        bool m_bSingle[GestureTable::BUTTONS];
+        tick_t m_tick_single[GestureTable::BUTTONS];
+        // interval of a too late second click waiting for a retry, and when
+        tick_t m_tick_late[GestureTable::BUTTONS];
+        tick_t m_tick_late_at[GestureTable::BUTTONS];
+};
+
+// live, on the timerfd of the epoll loop
+typedef BasicButtonProcess<TimerFdAlarm, Output> ButtonProcess;
+
+#endif
@@ -0,0 +1,344 @@
+// @brief: compact binary log of the raw input, for replay (capture_replay.h)
+//
+// every record is an 8 byte header and up to 255 bytes of payload:
+//    uint32 delta    us since the previous record
+//    uint16 dev      N of /dev/input/eventN, 0 for mousedev
+//    uint8 type      CAPTURE_*
+//    uint8 len       payload bytes
+// CAPTURE_START opens a session with the absolute CLOCK_MONOTONIC time,
+// a file can hold many sessions, --record appends. mousedev bytes are
+// logged as read, ACKs and all, evdev events of the same time stamp
+// share one record. all fields are host byte order
+//
+// writes are buffered and go out with one write() when the buffer is full
+// or a second after the last one, and at exit
+
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <linux/input.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+
+enum {
+    CAPTURE_START = 1,      // uint32 magic, uint32 version, int64 time
+    CAPTURE_TIME,           // int64 time, the delta did not fit
+    CAPTURE_PROTOCOL,       // uint8 Ps2Probe id of the mousedev stream
+    CAPTURE_PS2,            // mousedev bytes
+    CAPTURE_EVDEV           // capture_event[]
+};
+
+enum {
+    CAPTURE_MAGIC = 0x4c52434d,     // "MCRL"
+    CAPTURE_VERSION = 1,
+    CAPTURE_MAX_PAYLOAD = 255
+};
+
+struct capture_header
+{
+    uint32_t delta;
+    uint16_t dev;
+    uint8_t type;
+    uint8_t len;
+};
+
+// input_event without its time, the record has it
+struct capture_event
+{
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
+
+class CaptureLog
+{
+    public:
+        enum {
+            BUFFER_SIZE = 4096,
+            FLUSH_TICKS = TICKS_PER_SEC
+        };
+
+    public:
+        CaptureLog()
+        :m_fd(-1),
+        m_nLen(0),
+        m_tick_last(0),
+        m_tick_flush(0)
+        {
+        }
+
+        ~CaptureLog()
+        {
+            Close();
+        }
+
+        // append to path, a new session starts now
+        bool Open(const char *path)
+        {
+            m_fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+            if (m_fd == -1)
+            {
+                return false;
+            }
+
+            tick_t now = NowTick();
+            uint8_t start[16];
+            uint32_t magic = CAPTURE_MAGIC;
+            uint32_t version = CAPTURE_VERSION;
+            memcpy(start, &magic, 4);
+            memcpy(start + 4, &version, 4);
+            memcpy(start + 8, &now, 8);
+            m_tick_last = now;
+            m_tick_flush = now;
+            Record(now, 0, CAPTURE_START, start, sizeof(start));
+            return Flush();
+        }
+
+        bool IsOpen()
+        {
+            return m_fd != -1;
+        }
+
+        void Close()
+        {
+            if (m_fd != -1)
+            {
+                Flush();
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+
+        void Protocol(int id, tick_t time)
+        {
+            uint8_t b = id;
+            Record(time, 0, CAPTURE_PROTOCOL, &b, 1);
+        }
+
+        // bytes of one mousedev read
+        void Ps2(const uint8_t *p, unsigned nLen, tick_t time)
+        {
+            while (nLen > 0)
+            {
+                unsigned n = nLen < (unsigned)CAPTURE_MAX_PAYLOAD ? nLen : (unsigned)CAPTURE_MAX_PAYLOAD;
+                Record(time, 0, CAPTURE_PS2, p, n);
+                p += n;
+                nLen -= n;
+            }
+        }
+
+        // events of one time stamp
+        void Evdev(int dev, const struct input_event *events, unsigned nCount, tick_t time)
+        {
+            enum { PER_RECORD = CAPTURE_MAX_PAYLOAD / sizeof(capture_event) };
+            capture_event buf[PER_RECORD];
+            while (nCount > 0)
+            {
+                unsigned n = nCount < (unsigned)PER_RECORD ? nCount : (unsigned)PER_RECORD;
+                for (unsigned i = 0; i < n; i++)
+                {
+                    buf[i].type = events[i].type;
+                    buf[i].code = events[i].code;
+                    buf[i].value = events[i].value;
+                }
+                Record(time, dev, CAPTURE_EVDEV, buf, n * sizeof(capture_event));
+                events += n;
+                nCount -= n;
+            }
+        }
+
+        // write the buffer, false on write error (the log stops)
+        bool Flush()
+        {
+            unsigned nPos = 0;
+            while (nPos < m_nLen && m_fd != -1)
+            {
+                ssize_t nLen = write(m_fd, m_buffer + nPos, m_nLen - nPos);
+                if (nLen == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    close(m_fd);
+                    m_fd = -1;
+                    m_nLen = 0;
+                    return false;
+                }
+                nPos += nLen;
+            }
+            m_nLen = 0;
+            return true;
+        }
+
+    private:
+        void Record(tick_t time, int dev, int type, const void *payload, unsigned nLen)
+        {
+            if (m_fd == -1)
+            {
+                return;
+            }
+
+            tick_t delta = time - m_tick_last;
+            if (delta < 0 || delta > (tick_t)UINT32_MAX)
+            {
+                // idle for over an hour, or a clock step
+                m_tick_last = time;
+                Append(0, 0, CAPTURE_TIME, &time, sizeof(time));
+                delta = 0;
+            }
+            m_tick_last = time;
+            Append((uint32_t)delta, dev, type, payload, nLen);
+
+            if (time - m_tick_flush >= FLUSH_TICKS)
+            {
+                m_tick_flush = time;
+                Flush();
+            }
+        }
+
+        void Append(uint32_t delta, int dev, int type, const void *payload, unsigned nLen)
+        {
+            if (m_nLen + sizeof(capture_header) + nLen > sizeof(m_buffer))
+            {
+                Flush();
+            }
+            capture_header h;
+            h.delta = delta;
+            h.dev = dev;
+            h.type = type;
+            h.len = nLen;
+            memcpy(m_buffer + m_nLen, &h, sizeof(h));
+            memcpy(m_buffer + m_nLen + sizeof(h), payload, nLen);
+            m_nLen += sizeof(h) + nLen;
+        }
+
+    private:
+        int m_fd;
+        uint8_t m_buffer[BUFFER_SIZE];
+        unsigned m_nLen;
+        // time of the previous record
+        tick_t m_tick_last;
+        tick_t m_tick_flush;
+};
+
+// reads a log record by record
+class CaptureFile
+{
+    public:
+        enum { BUFFER_SIZE = 65536 };
+
+    public:
+        CaptureFile()
+        :m_fd(-1),
+        m_nPos(0),
+        m_nLen(0),
+        m_tick_last(0)
+        {
+        }
+
+        ~CaptureFile()
+        {
+            if (m_fd != -1)
+            {
+                close(m_fd);
+            }
+        }
+
+        bool Open(const char *path)
+        {
+            m_fd = open(path, O_RDONLY|O_CLOEXEC);
+            return m_fd != -1;
+        }
+
+        // next record, time is absolute. false at the end or on a broken
+        // log, a record cut short by a crash ends the log
+        bool Next(capture_header &h, tick_t &time, const uint8_t *&payload)
+        {
+            while (true)
+            {
+                if (!Need(sizeof(capture_header)))
+                {
+                    return false;
+                }
+                memcpy(&h, m_buffer + m_nPos, sizeof(h));
+                if (!Need(sizeof(h) + h.len))
+                {
+                    return false;
+                }
+                payload = m_buffer + m_nPos + sizeof(h);
+                m_nPos += sizeof(h) + h.len;
+
+                if (h.type == CAPTURE_TIME || h.type == CAPTURE_START)
+                {
+                    unsigned nOffset = h.type == CAPTURE_START ? 8 : 0;
+                    if (h.len < nOffset + sizeof(tick_t))
+                    {
+                        return false;
+                    }
+                    if (h.type == CAPTURE_START)
+                    {
+                        uint32_t magic, version;
+                        memcpy(&magic, payload, 4);
+                        memcpy(&version, payload + 4, 4);
+                        if (magic != CAPTURE_MAGIC || version != CAPTURE_VERSION)
+                        {
+                            return false;
+                        }
+                    }
+                    memcpy(&m_tick_last, payload + nOffset, sizeof(tick_t));
+                    if (h.type == CAPTURE_TIME)
+                    {
+                        continue;
+                    }
+                }
+                else
+                {
+                    m_tick_last += h.delta;
+                }
+                time = m_tick_last;
+                return true;
+            }
+        }
+
+    private:
+        // nLen bytes at m_nPos in the buffer
+        bool Need(unsigned nLen)
+        {
+            if (m_nLen - m_nPos >= nLen)
+            {
+                return true;
+            }
+            memmove(m_buffer, m_buffer + m_nPos, m_nLen - m_nPos);
+            m_nLen -= m_nPos;
+            m_nPos = 0;
+            while (m_nLen < nLen)
+            {
+                ssize_t n = read(m_fd, m_buffer + m_nLen, sizeof(m_buffer) - m_nLen);
+                if (n == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (n <= 0)
+                {
+                    return false;
+                }
+                m_nLen += n;
+            }
+            return true;
+        }
+
+    private:
+        int m_fd;
+        uint8_t m_buffer[BUFFER_SIZE];
+        unsigned m_nPos;
+        unsigned m_nLen;
+        tick_t m_tick_last;
+};
+
+#endif
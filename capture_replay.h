@@ -0,0 +1,309 @@
+// @brief: replay of a capture log (capture_log.h) through the gesture state
+//
+// the recorded bytes and events go through the same readers and
+// gesture logic as live input, on a virtual clock: report times come from
+// the log, and the click and wheel deadlines fire in time order between
+// the records instead of from a timerfd. so a replay gives the actions of
+// the recording whether it runs at the recorded speed or as fast as it
+// can. sessions appended to one log play back to back
+
+#ifndef CAPTURE_REPLAY_H
+#define CAPTURE_REPLAY_H
+
+#include <string.h>
+
+#include "mono_tick.h"
+#include "capture_log.h"
+#include "imps2_reader.h"
+#include "ps2_batch.h"
+#include "evdev_reader.h"
+#include "button_process.h"
+#include "device_manager.h"
+#include "output.h"
+
+// deadlines are served by Due()/Step(), not by a timerfd
+typedef BasicButtonProcess<VirtualAlarm, Output> ReplayProcess;
+
+class CaptureReplay
+{
+    public:
+        enum { MAX_DEVICES = 8 };
+
+    public:
+        CaptureReplay(Output &output, const button_config &config)
+        :m_output(output),
+        m_config(config),
+        m_bHeld(false),
+        m_bEnd(false),
+        m_tick_record(0),
+        m_tick_shift(0),
+        m_tick_now(0),
+        m_bStarted(false),
+        m_nProtocol(Ps2Protocol::ID),
+        m_ps2Reader(-1),
+        m_exps2Reader(-1),
+        m_pMice(NULL)
+        {
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                m_devices[i].dev = -1;
+                m_devices[i].pReader = NULL;
+                m_devices[i].pProcess = NULL;
+            }
+        }
+
+        ~CaptureReplay()
+        {
+            Reset();
+        }
+
+        bool Open(const char *path)
+        {
+            return m_file.Open(path);
+        }
+
+        // virtual time of the next step, false when the log is done
+        bool Due(tick_t &time)
+        {
+            Peek();
+            ReplayProcess *p;
+            tick_t deadline;
+            if (Deadline(p, deadline) && (m_bEnd || m_header.type == CAPTURE_START || deadline <= m_tick_record))
+            {
+                // pending windows close before the next record, all of them
+                // before a new session
+                time = deadline;
+                return true;
+            }
+            if (m_bEnd)
+            {
+                return false;
+            }
+            time = m_tick_record;
+            return true;
+        }
+
+        // one deadline or one record, DEVICE_QUIT on q
+        int Step()
+        {
+            tick_t time;
+            if (!Due(time))
+            {
+                return DEVICE_OK;
+            }
+            m_tick_now = time;
+
+            ReplayProcess *p;
+            tick_t deadline;
+            if (Deadline(p, deadline) && deadline == time &&
+                (m_bEnd || m_header.type == CAPTURE_START || deadline <= m_tick_record))
+            {
+                p->Timer(deadline);
+                return DEVICE_OK;
+            }
+
+            m_bHeld = false;
+            switch (m_header.type)
+            {
+                case CAPTURE_START:
+                    // the devices of the last session are gone
+                    Reset();
+                    break;
+                case CAPTURE_PROTOCOL:
+                    if (m_header.len >= 1)
+                    {
+                        m_nProtocol = m_payload[0];
+                    }
+                    break;
+                case CAPTURE_PS2:
+                    return Mice(time);
+                case CAPTURE_EVDEV:
+                    return Evdev(time);
+            }
+            return DEVICE_OK;
+        }
+
+    private:
+        struct replay_device
+        {
+            int dev;
+            EvdevReader *pReader;
+            ReplayProcess *pProcess;
+        };
+
+        // read the next record if none is held
+        void Peek()
+        {
+            if (m_bHeld || m_bEnd)
+            {
+                return;
+            }
+            tick_t time;
+            const uint8_t *payload;
+            if (!m_file.Next(m_header, time, payload))
+            {
+                m_bEnd = true;
+                return;
+            }
+            memcpy(m_payload, payload, m_header.len);
+            m_bHeld = true;
+
+            if (m_header.type == CAPTURE_START || !m_bStarted)
+            {
+                // a new session continues where the last one ended,
+                // the virtual clock never goes back
+                m_tick_shift = (m_bStarted ? m_tick_now : time) - time;
+                m_bStarted = true;
+            }
+            m_tick_record = time + m_tick_shift;
+        }
+
+        // earliest deadline of all gesture states
+        bool Deadline(ReplayProcess *&pProcess, tick_t &deadline)
+        {
+            bool bFound = false;
+            pProcess = NULL;
+            deadline = 0;
+            tick_t t;
+            if (m_pMice && m_pMice->NextDeadline(t))
+            {
+                bFound = true;
+                deadline = t;
+                pProcess = m_pMice;
+            }
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                ReplayProcess *p = m_devices[i].pProcess;
+                if (p && p->NextDeadline(t) && (!bFound || t < deadline))
+                {
+                    bFound = true;
+                    deadline = t;
+                    pProcess = p;
+                }
+            }
+            return bFound;
+        }
+
+        int Mice(tick_t time)
+        {
+            if (m_pMice == NULL)
+            {
+                m_pMice = new ReplayProcess(VirtualAlarm(), m_output, 0, m_config);
+            }
+            return m_nProtocol == ExplorerProtocol::ID ? Feed(m_exps2Reader, time) :
+                m_nProtocol == Imps2Protocol::ID ? Feed(m_imps2Reader, time) :
+                Feed(m_ps2Reader, time);
+        }
+
+        template <class R>
+        int Feed(R &reader, tick_t time)
+        {
+            reader.Feed(m_payload, m_header.len);
+            mouse_report report;
+            while (reader.Next(report, time))
+            {
+                if (!m_pMice->Report(report))
+                {
+                    return DEVICE_QUIT;
+                }
+            }
+            return DEVICE_OK;
+        }
+
+        int Evdev(tick_t time)
+        {
+            replay_device *d = Find(m_header.dev);
+            if (d == NULL)
+            {
+                // more devices than a live run takes
+                return DEVICE_OK;
+            }
+
+            // the payload is not aligned for capture_event
+            capture_event events[CAPTURE_MAX_PAYLOAD / sizeof(capture_event)];
+            unsigned nCount = m_header.len / sizeof(capture_event);
+            memcpy(events, m_payload, nCount * sizeof(capture_event));
+            d->pReader->Feed(events, nCount, time);
+
+            mouse_report report;
+            while (d->pReader->Next(report))
+            {
+                if (!d->pProcess->Report(report))
+                {
+                    return DEVICE_QUIT;
+                }
+            }
+            return DEVICE_OK;
+        }
+
+        // state of dev, created on its first record
+        replay_device *Find(int dev)
+        {
+            replay_device *pFree = NULL;
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                if (m_devices[i].dev == dev)
+                {
+                    return &m_devices[i];
+                }
+                if (m_devices[i].dev == -1 && pFree == NULL)
+                {
+                    pFree = &m_devices[i];
+                }
+            }
+            if (pFree)
+            {
+                pFree->dev = dev;
+                pFree->pReader = new EvdevReader(-1);
+                pFree->pProcess = new ReplayProcess(VirtualAlarm(), m_output, dev, m_config);
+            }
+            return pFree;
+        }
+
+        void Reset()
+        {
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                delete m_devices[i].pReader;
+                delete m_devices[i].pProcess;
+                m_devices[i].dev = -1;
+                m_devices[i].pReader = NULL;
+                m_devices[i].pProcess = NULL;
+            }
+            delete m_pMice;
+            m_pMice = NULL;
+            m_nProtocol = Ps2Protocol::ID;
+            // a packet cut by the end of the last session is no start of
+            // the next one
+            m_ps2Reader.Reset();
+            m_imps2Reader.Reset();
+            m_exps2Reader.Reset();
+        }
+
+    private:
+        Output &m_output;
+        const button_config &m_config;
+        CaptureFile m_file;
+
+        // next record, read ahead
+        bool m_bHeld;
+        bool m_bEnd;
+        capture_header m_header;
+        uint8_t m_payload[CAPTURE_MAX_PAYLOAD];
+        tick_t m_tick_record;
+
+        // virtual clock: log time + shift
+        tick_t m_tick_shift;
+        tick_t m_tick_now;
+        bool m_bStarted;
+
+        int m_nProtocol;
+        Ps2Reader<Ps2Protocol> m_ps2Reader;
+        // IMPS/2 captures are long runs of aligned packets
+        Imps2BatchReader m_imps2Reader;
+        Ps2Reader<ExplorerProtocol> m_exps2Reader;
+        ReplayProcess *m_pMice;
+        replay_device m_devices[MAX_DEVICES];
+};
+
+#endif
@@ -0,0 +1,66 @@
+// @brief: where the deadlines of a gesture state go, the clock policy of
+//         BasicButtonProcess
+//
+// the gesture logic never reads a clock: every report carries its time
+// and Timer() gets the time it fires at. what is left of the clock is who
+// wakes the process at the next deadline. an alarm is a plain member,
+// Set() and Clear() are inlined, so the live build pays nothing for it
+//
+//    void Set(tick_t deadline)   next deadline, absolute
+//    void Clear()                nothing pending
+
+#ifndef DEADLINE_ALARM_H
+#define DEADLINE_ALARM_H
+
+#include <sys/timerfd.h>
+
+#include "mono_tick.h"
+
+// live: a CLOCK_MONOTONIC timerfd in the epoll loop, single shot
+class TimerFdAlarm
+{
+    public:
+        TimerFdAlarm(int timer_fd)
+        :m_timer_fd(timer_fd)
+        {
+        }
+
+        void Set(tick_t deadline)
+        {
+            struct itimerspec its;
+            its.it_interval.tv_sec = 0;
+            its.it_interval.tv_nsec = 0;
+            TickToTimespec(deadline, its.it_value);
+            timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+        }
+
+        void Clear()
+        {
+            // disarm
+            struct itimerspec its;
+            its.it_interval.tv_sec = 0;
+            its.it_interval.tv_nsec = 0;
+            its.it_value.tv_sec = 0;
+            its.it_value.tv_nsec = 0;
+            timerfd_settime(m_timer_fd, 0, &its, NULL);
+        }
+
+    private:
+        int m_timer_fd;
+};
+
+// virtual clock: nothing to arm, the driver asks NextDeadline() of the
+// process and calls Timer() when its clock gets there (virtual_clock.h)
+class VirtualAlarm
+{
+    public:
+        void Set(tick_t)
+        {
+        }
+
+        void Clear()
+        {
+        }
+};
+
+#endif
@@ -0,0 +1,509 @@
+// @brief: evdev mice with per device gesture state, opened and closed on
+//         hotplug
+//
+// inotify on /dev/input reports nodes coming and going in the same epoll
+// loop. every mouse has its own reader, timerfd and ButtonProcess, its
+// actions are tagged with N of its eventN node
+
+#ifndef DEVICE_MANAGER_H
+#define DEVICE_MANAGER_H
+
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+#include "evdev_reader.h"
+#include "button_process.h"
+#include "output.h"
+#include "capture_log.h"
+#include "latency_stats.h"
+#include "runtime_counters.h"
+#include "trace_writer.h"
+
+// result of an event on a device fd
+enum {
+    DEVICE_OK,
+    DEVICE_GONE,    // unplugged or read error
+    DEVICE_QUIT     // q action, program exits
+};
+
+// one evdev mouse
+class MouseDevice
+{
+    public:
+        MouseDevice(int dev, int fd, int timer_fd, Output &output, const button_config &config)
+        :m_nDev(dev),
+        m_fd(fd),
+        m_timer_fd(timer_fd),
+        m_reader(fd),
+        m_btnProcess(TimerFdAlarm(timer_fd), output, dev, config),
+        m_pLog(NULL),
+        m_pStats(NULL),
+        m_pCounters(NULL),
+        m_pTrace(NULL)
+        {
+        }
+
+        ~MouseDevice()
+        {
+            close(m_fd);
+            close(m_timer_fd);
+        }
+
+        int Dev()
+        {
+            return m_nDev;
+        }
+
+        int Fd()
+        {
+            return m_fd;
+        }
+
+        int TimerFd()
+        {
+            return m_timer_fd;
+        }
+
+        bool Setup(bool bGrab)
+        {
+            return m_reader.Setup(bGrab);
+        }
+
+        // raw events to a capture log, NULL is off
+        void SetLog(CaptureLog *pLog)
+        {
+            m_pLog = pLog;
+        }
+
+        // read delay and timer lateness histograms, NULL is off
+        void SetStats(LatencyStats *pStats)
+        {
+            m_pStats = pStats;
+        }
+
+        // reader and timer counters, NULL is off
+        void SetCounters(RuntimeCounters *pCounters)
+        {
+            m_pCounters = pCounters;
+            m_reader.SetCounters(pCounters);
+        }
+
+        // reads and timers on the timeline, NULL is off
+        void SetTrace(TraceWriter *pTrace)
+        {
+            m_pTrace = pTrace;
+        }
+
+        // one batch of events
+        int Input()
+        {
+            tick_t start = m_pTrace ? NowTick() : 0;
+            int nLen = m_reader.Fill();
+            if (m_pTrace && nLen > 0)
+            {
+                m_pTrace->Slice(TraceWriter::TRACE_READ, m_nDev + 1, start, NowTick(), nLen);
+            }
+            if (nLen == 0 || (nLen == -1 && errno != EAGAIN))
+            {
+                // ENODEV after unplug
+                return DEVICE_GONE;
+            }
+            if (nLen > 0 && m_pLog)
+            {
+                m_reader.Log(*m_pLog, m_nDev);
+            }
+            bool bStamped = m_pStats && m_reader.IsMonotonic();
+            if (nLen > 0 && m_pStats)
+            {
+                m_pStats->Batch(NowTick());
+            }
+
+            mouse_report report;
+            while (m_reader.Next(report))
+            {
+                if (bStamped)
+                {
+                    m_pStats->Read(report.time);
+                }
+                if (!m_btnProcess.Report(report))
+                {
+                    return DEVICE_QUIT;
+                }
+            }
+            return DEVICE_OK;
+        }
+
+        int Timer()
+        {
+            uint64_t expirations;
+            if (read(m_timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            {
+                return DEVICE_OK;
+            }
+            if (m_pCounters)
+            {
+                m_pCounters->Add(RuntimeCounters::TIMER_FIRES, expirations);
+            }
+
+            // input first, a second click may already be queued
+            int ret = Input();
+            if (ret != DEVICE_OK)
+            {
+                return ret;
+            }
+            tick_t now = NowTick();
+            tick_t deadline;
+            bool bDue = m_btnProcess.NextDeadline(deadline) && deadline <= now;
+            if (m_pStats && bDue)
+            {
+                m_pStats->Timer(deadline, now);
+                m_pStats->Batch(now);
+            }
+            m_btnProcess.Timer(now);
+            if (m_pTrace && bDue)
+            {
+                m_pTrace->Slice(TraceWriter::TRACE_TIMER, m_nDev + 1, now, NowTick(), (int32_t)(now - deadline));
+            }
+            return DEVICE_OK;
+        }
+
+    private:
+        int m_nDev;
+        int m_fd;
+        int m_timer_fd;
+        EvdevReader m_reader;
+        ButtonProcess m_btnProcess;
+        CaptureLog *m_pLog;
+        LatencyStats *m_pStats;
+        RuntimeCounters *m_pCounters;
+        TraceWriter *m_pTrace;
+};
+
+class DeviceManager
+{
+    public:
+        enum { MAX_DEVICES = 8 };
+
+    public:
+        DeviceManager(Output &output, const button_config &config)
+        :m_output(output),
+        m_config(config),
+        m_epoll_fd(-1),
+        m_inotify_fd(-1),
+        m_bGrab(false),
+        m_pLog(NULL),
+        m_pStats(NULL),
+        m_pCounters(NULL),
+        m_pTrace(NULL)
+        {
+            m_dir[0] = '\0';
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                m_devices[i] = NULL;
+            }
+        }
+
+        ~DeviceManager()
+        {
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                delete m_devices[i];
+            }
+            if (m_inotify_fd != -1)
+            {
+                close(m_inotify_fd);
+            }
+        }
+
+        void Setup(int epoll_fd, bool bGrab)
+        {
+            m_epoll_fd = epoll_fd;
+            m_bGrab = bGrab;
+        }
+
+        // raw events of every device to a capture log (--record)
+        void SetLog(CaptureLog *pLog)
+        {
+            m_pLog = pLog;
+        }
+
+        // latency histograms of every device
+        void SetStats(LatencyStats *pStats)
+        {
+            m_pStats = pStats;
+        }
+
+        // runtime counters of every device
+        void SetCounters(RuntimeCounters *pCounters)
+        {
+            m_pCounters = pCounters;
+        }
+
+        // timeline of every device (--trace)
+        void SetTrace(TraceWriter *pTrace)
+        {
+            m_pTrace = pTrace;
+        }
+
+        // one fixed device, the program ends when it goes away
+        bool Add(const char *path)
+        {
+            int dev = EvdevReader::EventNumber(path);
+            return Open(path, dev < 0 ? 0 : dev, false);
+        }
+
+        // every mouse in dir now and later
+        bool Watch(const char *dir)
+        {
+            if (strlen(dir) >= sizeof(m_dir))
+            {
+                return false;
+            }
+            strcpy(m_dir, dir);
+
+            m_inotify_fd = inotify_init();
+            if (m_inotify_fd == -1)
+            {
+                return false;
+            }
+            fcntl(m_inotify_fd, F_SETFL, O_NONBLOCK);
+            fcntl(m_inotify_fd, F_SETFD, FD_CLOEXEC);
+
+            // udev creates the node first and fixes its mode later, retry on IN_ATTRIB
+            if (inotify_add_watch(m_inotify_fd, m_dir, IN_CREATE|IN_ATTRIB|IN_DELETE) == -1)
+            {
+                return false;
+            }
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = m_inotify_fd;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_inotify_fd, &ev) == -1)
+            {
+                return false;
+            }
+
+            // watch first, scan next, so no node falls in between
+            DIR *d = opendir(m_dir);
+            if (d == NULL)
+            {
+                return false;
+            }
+            struct dirent *ent;
+            while ((ent = readdir(d)) != NULL)
+            {
+                Found(ent->d_name);
+            }
+            closedir(d);
+            return true;
+        }
+
+        bool Owns(int fd)
+        {
+            return fd == m_inotify_fd || Find(fd) != NULL;
+        }
+
+        // DEVICE_QUIT on q, DEVICE_GONE if a fixed device went away
+        int Event(int fd)
+        {
+            if (fd == m_inotify_fd)
+            {
+                Inotify();
+                return DEVICE_OK;
+            }
+
+            MouseDevice **pp = Find(fd);
+            if (pp == NULL)
+            {
+                return DEVICE_OK;
+            }
+
+            MouseDevice *p = *pp;
+            int ret = (fd == p->Fd()) ? p->Input() : p->Timer();
+            if (ret == DEVICE_GONE)
+            {
+                Close(pp);
+                if (m_inotify_fd != -1)
+                {
+                    // reconnect comes through inotify
+                    return DEVICE_OK;
+                }
+            }
+            return ret;
+        }
+
+    private:
+        MouseDevice **Find(int fd)
+        {
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                if (m_devices[i] && (m_devices[i]->Fd() == fd || m_devices[i]->TimerFd() == fd))
+                {
+                    return &m_devices[i];
+                }
+            }
+            return NULL;
+        }
+
+        MouseDevice **FindDev(int dev)
+        {
+            for (int i = 0; i < MAX_DEVICES; i++)
+            {
+                if (m_devices[i] && m_devices[i]->Dev() == dev)
+                {
+                    return &m_devices[i];
+                }
+            }
+            return NULL;
+        }
+
+        // node name in m_dir appeared or changed
+        void Found(const char *name)
+        {
+            int dev = EvdevReader::EventNumber(name);
+            if (dev < 0 || FindDev(dev) != NULL)
+            {
+                return;
+            }
+
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", m_dir, name);
+            Open(path, dev, true);
+        }
+
+        bool Open(const char *path, int dev, bool bOnlyMouse)
+        {
+            MouseDevice **pp = NULL;
+            for (int i = 0; i < MAX_DEVICES && pp == NULL; i++)
+            {
+                if (m_devices[i] == NULL)
+                {
+                    pp = &m_devices[i];
+                }
+            }
+            if (pp == NULL)
+            {
+                return false;
+            }
+
+            int fd = open(path, O_RDONLY|O_NONBLOCK);
+            if (fd == -1)
+            {
+                // no permission yet, IN_ATTRIB follows
+                return false;
+            }
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            if (bOnlyMouse && !EvdevReader::IsMouse(fd))
+            {
+                close(fd);
+                return false;
+            }
+
+            int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+            if (timer_fd == -1)
+            {
+                close(fd);
+                return false;
+            }
+            fcntl(timer_fd, F_SETFD, FD_CLOEXEC);
+
+            MouseDevice *p = new MouseDevice(dev, fd, timer_fd, m_output, m_config);
+            p->SetLog(m_pLog);
+            p->SetStats(m_pStats);
+            p->SetCounters(m_pCounters);
+            p->SetTrace(m_pTrace);
+            if (!p->Setup(m_bGrab))
+            {
+                delete p;
+                return false;
+            }
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+            {
+                delete p;
+                return false;
+            }
+            ev.events = EPOLLIN;
+            ev.data.fd = timer_fd;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+            {
+                epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                delete p;
+                return false;
+            }
+            *pp = p;
+            return true;
+        }
+
+        void Close(MouseDevice **pp)
+        {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, (*pp)->Fd(), NULL);
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, (*pp)->TimerFd(), NULL);
+            delete *pp;
+            *pp = NULL;
+        }
+
+        void Inotify()
+        {
+            char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            while (true)
+            {
+                ssize_t nLen = read(m_inotify_fd, buf, sizeof(buf));
+                if (nLen <= 0)
+                {
+                    return;
+                }
+
+                for (char *p = buf; p < buf + nLen; )
+                {
+                    struct inotify_event *ie = (struct inotify_event *)p;
+                    p += sizeof(struct inotify_event) + ie->len;
+                    if (ie->len == 0)
+                    {
+                        continue;
+                    }
+
+                    if (ie->mask & IN_DELETE)
+                    {
+                        MouseDevice **pp = FindDev(EvdevReader::EventNumber(ie->name));
+                        if (pp)
+                        {
+                            Close(pp);
+                        }
+                    }
+                    else
+                    {
+                        Found(ie->name);
+                    }
+                }
+            }
+        }
+
+    private:
+        Output &m_output;
+        const button_config &m_config;
+        int m_epoll_fd;
+        int m_inotify_fd;
+        bool m_bGrab;
+        CaptureLog *m_pLog;
+        LatencyStats *m_pStats;
+        RuntimeCounters *m_pCounters;
+        TraceWriter *m_pTrace;
+        char m_dir[64];
+        MouseDevice *m_devices[MAX_DEVICES];
+};
+
+#endif
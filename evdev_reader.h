@@ -0,0 +1,387 @@
+// @brief: reader for an evdev node (/dev/input/eventN)
+// @see: linux kernel Documentation/input/input.txt
+
+#ifndef EVDEV_READER_H
+#define EVDEV_READER_H
+
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+
+#include "mouse_report.h"
+#include "capture_log.h"
+#include "runtime_counters.h"
+
+// linux 5.0, older headers do not have them
+#ifndef REL_WHEEL_HI_RES
+#define REL_WHEEL_HI_RES 0x0b
+#endif
+#ifndef REL_HWHEEL_HI_RES
+#define REL_HWHEEL_HI_RES 0x0c
+#endif
+
+// read arrays of input_event per syscall and frame them on SYN_REPORT
+// into mouse_report, like mousedev does but without its 8 bit clamping
+class EvdevReader
+{
+    public:
+        enum { EVENT_BATCH = 64 };
+
+    public:
+        EvdevReader(int fd)
+        :m_fd(fd),
+        m_nCount(0),
+        m_nPos(0),
+        m_nPartial(0),
+        m_bChanged(false),
+        m_bDropped(false),
+        m_bHiRes(false),
+        m_bHHiRes(false),
+        m_bMonotonic(false),
+        m_tick_read(0),
+        m_pCounters(NULL)
+        {
+            memset(&m_report, 0, sizeof(m_report));
+        }
+
+        // kernel timestamps from CLOCK_MONOTONIC, optionally grab the device
+        // so no other consumer (mousedev, X) sees the events
+        bool Setup(bool bGrab)
+        {
+            int clk = CLOCK_MONOTONIC;
+            if (ioctl(m_fd, EVIOCSCLOCKID, &clk) == -1)
+            {
+                // old kernel, realtime stamps are useless for us
+                //fprintf(stderr, "EVIOCSCLOCKID fail\n");
+                m_bMonotonic = false;
+            }
+            else
+            {
+                m_bMonotonic = true;
+            }
+
+            if (bGrab && ioctl(m_fd, EVIOCGRAB, 1) == -1)
+            {
+                return false;
+            }
+
+            SyncButtons();
+            return true;
+        }
+
+        // reads, reports and SYN_DROPPED, NULL is off
+        void SetCounters(RuntimeCounters *pCounters)
+        {
+            m_pCounters = pCounters;
+        }
+
+        // report times are kernel stamps, not read times
+        bool IsMonotonic()
+        {
+            return m_bMonotonic;
+        }
+
+        // relative x/y and a left button, what mousedev takes for a mouse
+        static bool IsMouse(int fd)
+        {
+            unsigned char rel[REL_MAX / 8 + 1];
+            unsigned char keys[KEY_MAX / 8 + 1];
+            memset(rel, 0, sizeof(rel));
+            memset(keys, 0, sizeof(keys));
+            if (ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel)), rel) == -1 ||
+                ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) == -1)
+            {
+                return false;
+            }
+            return (rel[REL_X / 8] & (1 << (REL_X % 8))) &&
+                (rel[REL_Y / 8] & (1 << (REL_Y % 8))) &&
+                (keys[BTN_LEFT / 8] & (1 << (BTN_LEFT % 8)));
+        }
+
+        // N of a path or name ending in eventN, -1 if it is none
+        static int EventNumber(const char *path)
+        {
+            const char *name = strrchr(path, '/');
+            name = name ? name + 1 : path;
+            if (strncmp(name, "event", 5) != 0 || name[5] == '\0')
+            {
+                return -1;
+            }
+
+            int n = 0;
+            for (const char *p = name + 5; *p; p++)
+            {
+                if (*p < '0' || *p > '9')
+                {
+                    return -1;
+                }
+                n = n * 10 + (*p - '0');
+            }
+            return n;
+        }
+
+        // one read of up to EVENT_BATCH events,
+        // return bytes read, 0 is end of file, -1 is error (see errno)
+        int Fill()
+        {
+            // previous batch is fully consumed by Next(). the kernel reads
+            // whole events, a pipe may cut one, its start is kept
+            char *p = (char *)m_events;
+            if (m_nPartial > 0)
+            {
+                memmove(p, p + m_nCount * sizeof(struct input_event), m_nPartial);
+            }
+            m_nCount = 0;
+            m_nPos = 0;
+
+            ssize_t nLen = read(m_fd, p + m_nPartial, sizeof(m_events) - m_nPartial);
+            if (nLen > 0)
+            {
+                unsigned nBytes = m_nPartial + nLen;
+                m_nCount = nBytes / sizeof(struct input_event);
+                m_nPartial = nBytes - m_nCount * sizeof(struct input_event);
+                if (!m_bMonotonic)
+                {
+                    m_tick_read = NowTick();
+                }
+            }
+            if (m_pCounters)
+            {
+                Count(nLen);
+            }
+            return nLen;
+        }
+
+        // the batch of the last Fill() to the capture log, one record per
+        // time stamp
+        void Log(CaptureLog &log, int dev)
+        {
+            unsigned nStart = 0;
+            for (unsigned i = 1; i <= m_nCount; i++)
+            {
+                if (i == m_nCount || m_events[i].time.tv_sec != m_events[nStart].time.tv_sec ||
+                    m_events[i].time.tv_usec != m_events[nStart].time.tv_usec)
+                {
+                    tick_t time = m_bMonotonic ? TimevalToTick(m_events[nStart].time) : m_tick_read;
+                    log.Evdev(dev, m_events + nStart, i - nStart, time);
+                    nStart = i;
+                }
+            }
+        }
+
+        // events of a replayed record instead of Fill(), all at time
+        void Feed(const capture_event *events, unsigned nCount, tick_t time)
+        {
+            if (nCount > (unsigned)EVENT_BATCH)
+            {
+                nCount = EVENT_BATCH;
+            }
+            for (unsigned i = 0; i < nCount; i++)
+            {
+                memset(&m_events[i], 0, sizeof(m_events[i]));
+                m_events[i].type = events[i].type;
+                m_events[i].code = events[i].code;
+                m_events[i].value = events[i].value;
+            }
+            m_nCount = nCount;
+            m_nPos = 0;
+            m_nPartial = 0;
+            // the record time stands in for the read time
+            m_bMonotonic = false;
+            m_tick_read = time;
+        }
+
+        // next complete report, false if batch holds no more SYN_REPORT
+        bool Next(mouse_report &report)
+        {
+            while (m_nPos < m_nCount)
+            {
+                const struct input_event &ev = m_events[m_nPos++];
+                if (ev.type == EV_SYN)
+                {
+                    if (ev.code == SYN_DROPPED)
+                    {
+                        // kernel buffer overrun, drop up to next SYN_REPORT
+                        m_bDropped = true;
+                        if (m_pCounters)
+                        {
+                            m_pCounters->Add(RuntimeCounters::EVENTS_DROPPED);
+                        }
+                    }
+                    else if (ev.code == SYN_REPORT)
+                    {
+                        if (m_bDropped)
+                        {
+                            // the deltas are lost, the buttons are not: a
+                            // press or release in the gap is reported here
+                            m_bDropped = false;
+                            ClearDelta();
+                            m_bChanged = SyncButtons();
+                        }
+
+                        if (m_bChanged || m_report.x || m_report.y || m_report.z_hires || m_report.w_hires)
+                        {
+                            m_report.time = m_bMonotonic ? TimevalToTick(ev.time) : m_tick_read;
+                            report = m_report;
+                            ClearDelta();
+                            if (m_pCounters)
+                            {
+                                m_pCounters->Add(RuntimeCounters::REPORTS);
+                            }
+                            return true;
+                        }
+                    }
+                }
+                else if (!m_bDropped)
+                {
+                    Event(ev);
+                }
+            }
+            return false;
+        }
+
+    private:
+        void Count(ssize_t nLen)
+        {
+            if (nLen > 0)
+            {
+                m_pCounters->Add(RuntimeCounters::READS);
+                if (m_nPartial)
+                {
+                    // a pipe cut an event
+                    m_pCounters->Add(RuntimeCounters::SHORT_READS);
+                }
+            }
+            else if (nLen == -1 && errno == EAGAIN)
+            {
+                m_pCounters->Add(RuntimeCounters::READ_EAGAIN);
+            }
+        }
+
+        void Event(const struct input_event &ev)
+        {
+            if (ev.type == EV_REL)
+            {
+                switch (ev.code)
+                {
+                    case REL_X:
+                        m_report.x += ev.value;
+                        break;
+                    case REL_Y:
+                        // ps/2 y axis points up
+                        m_report.y -= ev.value;
+                        break;
+                    case REL_WHEEL:
+                        // same sign as mousedev, > 0 rolling down
+                        m_report.z -= ev.value;
+                        if (!m_bHiRes)
+                        {
+                            m_report.z_hires -= ev.value * WheelAccumulator::UNITS_PER_DETENT;
+                        }
+                        break;
+                    case REL_WHEEL_HI_RES:
+                        // comes before the REL_WHEEL of the same frame
+                        m_bHiRes = true;
+                        m_report.z_hires -= ev.value;
+                        break;
+                    case REL_HWHEEL:
+                        if (!m_bHHiRes)
+                        {
+                            m_report.w_hires += ev.value * WheelAccumulator::UNITS_PER_DETENT;
+                        }
+                        break;
+                    case REL_HWHEEL_HI_RES:
+                        m_bHHiRes = true;
+                        m_report.w_hires += ev.value;
+                        break;
+                }
+            }
+            else if (ev.type == EV_KEY && ev.value != 2)
+            {
+                // value 2 is autorepeat
+                bool bDown = (ev.value != 0);
+                switch (ev.code)
+                {
+                    case BTN_LEFT:
+                        m_bChanged |= (m_report.btn_left != bDown);
+                        m_report.btn_left = bDown;
+                        break;
+                    case BTN_RIGHT:
+                        m_bChanged |= (m_report.btn_right != bDown);
+                        m_report.btn_right = bDown;
+                        break;
+                    case BTN_MIDDLE:
+                        m_bChanged |= (m_report.btn_middle != bDown);
+                        m_report.btn_middle = bDown;
+                        break;
+                    case BTN_SIDE:
+                        m_bChanged |= (m_report.btn_side != bDown);
+                        m_report.btn_side = bDown;
+                        break;
+                    case BTN_EXTRA:
+                        m_bChanged |= (m_report.btn_extra != bDown);
+                        m_report.btn_extra = bDown;
+                        break;
+                }
+            }
+        }
+
+        void ClearDelta()
+        {
+            m_report.x = 0;
+            m_report.y = 0;
+            m_report.z = 0;
+            m_report.z_hires = 0;
+            m_report.w_hires = 0;
+            m_bChanged = false;
+        }
+
+        // button state from the kernel, after open or SYN_DROPPED. true if
+        // it differs from the one we had
+        bool SyncButtons()
+        {
+            unsigned char keys[KEY_MAX / 8 + 1];
+            memset(keys, 0, sizeof(keys));
+            if (ioctl(m_fd, EVIOCGKEY(sizeof(keys)), keys) == -1)
+            {
+                return false;
+            }
+            mouse_report old = m_report;
+            m_report.btn_left = keys[BTN_LEFT / 8] & (1 << (BTN_LEFT % 8));
+            m_report.btn_right = keys[BTN_RIGHT / 8] & (1 << (BTN_RIGHT % 8));
+            m_report.btn_middle = keys[BTN_MIDDLE / 8] & (1 << (BTN_MIDDLE % 8));
+            m_report.btn_side = keys[BTN_SIDE / 8] & (1 << (BTN_SIDE % 8));
+            m_report.btn_extra = keys[BTN_EXTRA / 8] & (1 << (BTN_EXTRA % 8));
+            return old.btn_left != m_report.btn_left || old.btn_right != m_report.btn_right ||
+                old.btn_middle != m_report.btn_middle || old.btn_side != m_report.btn_side ||
+                old.btn_extra != m_report.btn_extra;
+        }
+
+    private:
+        int m_fd;
+        struct input_event m_events[EVENT_BATCH];
+        unsigned m_nCount;
+        unsigned m_nPos;
+        // bytes of a cut event after the batch
+        unsigned m_nPartial;
+
+        // report under construction
+        mouse_report m_report;
+        bool m_bChanged;
+        bool m_bDropped;
+        // the wheels report hi-res units, their detent events are only
+        // kept in z
+        bool m_bHiRes;
+        bool m_bHHiRes;
+
+        // kernel stamps are CLOCK_MONOTONIC, else use read time
+        bool m_bMonotonic;
+        tick_t m_tick_read;
+
+        RuntimeCounters *m_pCounters;
+};
+
+#endif
@@ -0,0 +1,216 @@
+// @brief: always-on ring of the last raw packets, reports, gesture
+//         transitions and actions, dumped when something went wrong
+//
+// a record is a handful of stores into a fixed array, no lock (one
+// thread), no syscall, no allocation. the ring is written out as text on
+// SIGUSR2, on a fatal error, on a crash and right after the q quit, so
+// "it quit on its own" comes with the packets that made it quit. Dump()
+// formats by hand with write() only, it is safe in a signal handler
+//
+// one line per record, oldest first, times in us of CLOCK_MONOTONIC:
+//    <time> <dev> ps2 <bytes in hex>       raw mousedev packet
+//    <time> <dev> skip <byte>              ACK or byte out of frame
+//    <time> <dev> report <buttons> <x> <y> <wheel units>
+//    <time> <dev> state <symbol> <from> <to> <timer>
+//    <time> <dev> action <code> <count>
+//    <time> <dev> quit | fatal | signal <n>
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+
+class FlightRecorder
+{
+    public:
+        enum {
+            RECORDS = 1024      // power of two, 24 KB
+        };
+
+        enum {
+            FLIGHT_NONE,
+            FLIGHT_PS2,
+            FLIGHT_SKIP,
+            FLIGHT_REPORT,
+            FLIGHT_STATE,
+            FLIGHT_ACTION,
+            FLIGHT_QUIT,
+            FLIGHT_FATAL,
+            FLIGHT_SIGNAL
+        };
+
+    public:
+        FlightRecorder()
+        :m_nNext(0)
+        {
+            memset(m_ring, 0, sizeof(m_ring));
+        }
+
+        void Record(int kind, tick_t time, int dev, int x, int32_t a = 0, int32_t b = 0, int32_t c = 0)
+        {
+            record &r = m_ring[m_nNext++ & (RECORDS - 1)];
+            r.time = time;
+            r.dev = dev;
+            r.kind = kind;
+            r.x = x;
+            r.a = a;
+            r.b = b;
+            r.c = c;
+        }
+
+        // text of the ring to path, truncated first
+        bool DumpTo(const char *path)
+        {
+            int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                return false;
+            }
+            Dump(fd);
+            close(fd);
+            return true;
+        }
+
+        // text of the ring to fd, oldest first. write() only
+        void Dump(int fd)
+        {
+            unsigned nFirst = m_nNext > (unsigned)RECORDS ? m_nNext - RECORDS : 0;
+            for (unsigned i = nFirst; i != m_nNext; i++)
+            {
+                const record &r = m_ring[i & (RECORDS - 1)];
+                char line[128];
+                unsigned n = Format(r, line);
+                if (write(fd, line, n) != (ssize_t)n)
+                {
+                    return;
+                }
+            }
+        }
+
+    private:
+        struct record
+        {
+            tick_t time;
+            uint16_t dev;
+            uint8_t kind;
+            uint8_t x;
+            int32_t a;
+            int32_t b;
+            int32_t c;
+        };
+
+        static unsigned Format(const record &r, char *p)
+        {
+            char *start = p;
+            p = Number(p, r.time);
+            *p++ = ' ';
+            p = Number(p, r.dev);
+            *p++ = ' ';
+            switch (r.kind)
+            {
+                case FLIGHT_PS2:
+                    p = Text(p, "ps2");
+                    for (int i = 0; i < r.x && i < 4; i++)
+                    {
+                        *p++ = ' ';
+                        p = Hex(p, (uint32_t)r.a >> (i * 8));
+                    }
+                    break;
+                case FLIGHT_SKIP:
+                    p = Text(p, "skip ");
+                    p = Hex(p, r.x);
+                    break;
+                case FLIGHT_REPORT:
+                    p = Text(p, "report ");
+                    p = Number(p, r.x);
+                    *p++ = ' ';
+                    p = Number(p, r.a);
+                    *p++ = ' ';
+                    p = Number(p, r.b);
+                    *p++ = ' ';
+                    p = Number(p, r.c);
+                    break;
+                case FLIGHT_STATE:
+                    p = Text(p, "state ");
+                    p = Number(p, r.x);
+                    *p++ = ' ';
+                    p = Number(p, r.a);
+                    *p++ = ' ';
+                    p = Number(p, r.b);
+                    *p++ = ' ';
+                    p = Number(p, r.c);
+                    break;
+                case FLIGHT_ACTION:
+                    p = Text(p, "action ");
+                    *p++ = r.x >= 0x20 && r.x < 0x7f ? (char)r.x : '?';
+                    *p++ = ' ';
+                    p = Number(p, r.a);
+                    break;
+                case FLIGHT_QUIT:
+                    p = Text(p, "quit");
+                    break;
+                case FLIGHT_FATAL:
+                    p = Text(p, "fatal");
+                    break;
+                case FLIGHT_SIGNAL:
+                    p = Text(p, "signal ");
+                    p = Number(p, r.x);
+                    break;
+                default:
+                    p = Text(p, "?");
+                    break;
+            }
+            *p++ = '\n';
+            return p - start;
+        }
+
+        static char *Text(char *p, const char *s)
+        {
+            while (*s)
+            {
+                *p++ = *s++;
+            }
+            return p;
+        }
+
+        static char *Number(char *p, int64_t v)
+        {
+            char buf[24];
+            int n = 0;
+            uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+            do
+            {
+                buf[n++] = '0' + u % 10;
+                u /= 10;
+            } while (u);
+            if (v < 0)
+            {
+                *p++ = '-';
+            }
+            while (n > 0)
+            {
+                *p++ = buf[--n];
+            }
+            return p;
+        }
+
+        static char *Hex(char *p, uint32_t b)
+        {
+            static const char digits[] = "0123456789abcdef";
+            *p++ = digits[(b >> 4) & 0x0f];
+            *p++ = digits[b & 0x0f];
+            return p;
+        }
+
+    private:
+        record m_ring[RECORDS];
+        // free running, the next record goes to m_nNext % RECORDS
+        unsigned m_nNext;
+};
+
+#endif
@@ -0,0 +1,362 @@
+// @brief: gesture bindings declared in C++ and compiled by the compiler
+//
+// for fixed function builds (-DSTATIC_GESTURES) without config parsing:
+// a spec is a struct of enum bindings derived from GestureSpec, the
+// templates below work out every (state, symbol) transition the same way
+// GestureTable::Compile() does and StaticGestureTable puts them in a
+// constant initialized table, read only data without any startup code.
+// no constexpr on our toolchain, so it is all integral constants
+//
+//    struct MyGestures : GestureSpec
+//    {
+//        enum {
+//            CLICK_LEFT = '<',
+//            DOUBLE_LEFT = 'z',
+//            CHORD_LEFT_RIGHT = 'q' | GESTURE_QUIT
+//        };
+//    };
+//
+// build with -DSTATIC_GESTURES -DGESTURE_SPEC=MyGestures, DefaultGestures
+// is the map of mouse_capture.cpp
+
+#ifndef GESTURE_SPEC_H
+#define GESTURE_SPEC_H
+
+#include "mono_tick.h"
+#include "gesture_table.h"
+
+// a binding is its action code, | GESTURE_QUIT exits the program
+enum { GESTURE_QUIT = 0x100 };
+
+// nothing bound, derived specs hide what they bind
+struct GestureSpec
+{
+    enum {
+        CLICK_LEFT = 0, DOUBLE_LEFT = 0, TRIPLE_LEFT = 0,
+        CLICK_RIGHT = 0, DOUBLE_RIGHT = 0, TRIPLE_RIGHT = 0,
+        CLICK_MIDDLE = 0, DOUBLE_MIDDLE = 0, TRIPLE_MIDDLE = 0,
+        LONG_LEFT = 0, LONG_RIGHT = 0, LONG_MIDDLE = 0,
+        PRESS_LEFT = 0, PRESS_RIGHT = 0, PRESS_MIDDLE = 0,
+        RELEASE_LEFT = 0, RELEASE_RIGHT = 0, RELEASE_MIDDLE = 0,
+        UPGRADE_LEFT = 0, UPGRADE_RIGHT = 0, UPGRADE_MIDDLE = 0,
+        CHORD_LEFT_RIGHT = 0, CHORD_LEFT_MIDDLE = 0, CHORD_RIGHT_MIDDLE = 0,
+        WHEEL_DOWN = 0, WHEEL_UP = 0, WHEEL_LEFT = 0, WHEEL_RIGHT = 0,
+        FINE_DOWN = 0, FINE_UP = 0, FINE_LEFT = 0, FINE_RIGHT = 0,
+
+        SPECULATIVE = 0,    // bit per button, see -S
+        MOTION_RESOLVE = 0, // see -m
+        LONG_MS = GestureTable::LONG_TICKS / TICKS_PER_MS
+    };
+};
+
+// the actions of mouse_capture.cpp
+struct DefaultGestures : GestureSpec
+{
+    enum {
+        CLICK_LEFT = '<',
+        DOUBLE_LEFT = 'z',
+        CLICK_RIGHT = '>',
+        DOUBLE_RIGHT = 'x',
+        CLICK_MIDDLE = 'p',
+        UPGRADE_LEFT = 'Z',
+        UPGRADE_RIGHT = 'X',
+        CHORD_LEFT_RIGHT = 'q' | GESTURE_QUIT,
+        WHEEL_DOWN = '9',
+        WHEEL_UP = '0',
+        WHEEL_LEFT = '[',
+        WHEEL_RIGHT = ']',
+        FINE_DOWN = 'j',
+        FINE_UP = 'k',
+        FINE_LEFT = 'h',
+        FINE_RIGHT = 'l'
+    };
+};
+
+// bindings of spec S per button b
+template <class S, int b>
+struct GestureBinding
+{
+    static const int L = GestureTable::BUTTON_LEFT;
+    static const int R = GestureTable::BUTTON_RIGHT;
+
+    static const int CLICK1 = b == L ? (int)S::CLICK_LEFT : b == R ? (int)S::CLICK_RIGHT : (int)S::CLICK_MIDDLE;
+    static const int CLICK2 = b == L ? (int)S::DOUBLE_LEFT : b == R ? (int)S::DOUBLE_RIGHT : (int)S::DOUBLE_MIDDLE;
+    static const int CLICK3 = b == L ? (int)S::TRIPLE_LEFT : b == R ? (int)S::TRIPLE_RIGHT : (int)S::TRIPLE_MIDDLE;
+    static const int LONG = b == L ? (int)S::LONG_LEFT : b == R ? (int)S::LONG_RIGHT : (int)S::LONG_MIDDLE;
+    static const int PRESS = b == L ? (int)S::PRESS_LEFT : b == R ? (int)S::PRESS_RIGHT : (int)S::PRESS_MIDDLE;
+    static const int RELEASE = b == L ? (int)S::RELEASE_LEFT : b == R ? (int)S::RELEASE_RIGHT : (int)S::RELEASE_MIDDLE;
+    static const int UPGRADE = b == L ? (int)S::UPGRADE_LEFT : b == R ? (int)S::UPGRADE_RIGHT : (int)S::UPGRADE_MIDDLE;
+    static const int CHORD_L = b == R ? (int)S::CHORD_LEFT_RIGHT : b == L ? 0 : (int)S::CHORD_LEFT_MIDDLE;
+    static const int CHORD_R = b == L ? (int)S::CHORD_LEFT_RIGHT : b == R ? 0 : (int)S::CHORD_RIGHT_MIDDLE;
+    static const int CHORD_M = b == L ? (int)S::CHORD_LEFT_MIDDLE : b == R ? (int)S::CHORD_RIGHT_MIDDLE : 0;
+
+    static const int MAX_CLICKS = CLICK3 != 0 ? 3 : CLICK2 != 0 ? 2 : CLICK1 != 0 ? 1 : 0;
+    static const bool IS_CHORD = CHORD_L != 0 || CHORD_R != 0 || CHORD_M != 0;
+    static const bool IS_INSTANT = MAX_CLICKS <= 1 && LONG == 0 && !IS_CHORD;
+    static const bool SPECULATIVE = ((S::SPECULATIVE >> b) & 1) && MAX_CLICKS > 1;
+};
+
+template <class S, int b, int c>
+struct GestureChord
+{
+    static const int value = c == GestureTable::BUTTON_LEFT ? GestureBinding<S, b>::CHORD_L :
+        c == GestureTable::BUTTON_RIGHT ? GestureBinding<S, b>::CHORD_R :
+        GestureBinding<S, b>::CHORD_M;
+};
+
+// action of n clicks of b when they are decided, see GestureTable::ClickAction()
+template <class S, int b, int n>
+struct GestureClick
+{
+    typedef GestureBinding<S, b> B;
+    static const int CLICK = n == 1 ? B::CLICK1 : n == 2 ? B::CLICK2 : B::CLICK3;
+    static const int value = !B::SPECULATIVE ? CLICK :
+        n == 1 ? 0 : (n == 2 && B::UPGRADE != 0) ? B::UPGRADE : CLICK;
+    // the press can not tell anything more
+    static const bool FINAL = n >= B::MAX_CLICKS && !(n == 1 && (B::LONG != 0 || B::IS_CHORD));
+};
+
+// state arithmetic of GestureTable
+template <int s>
+struct GestureState
+{
+    static const bool PENDING = s >= GestureTable::STATE_DOWN && s < GestureTable::STATE_HELD;
+    static const bool DOWN = s >= GestureTable::STATE_DOWN && s < GestureTable::STATE_UP;
+    static const bool HELD = s >= GestureTable::STATE_HELD;
+    static const int BUTTON = HELD ? s - GestureTable::STATE_HELD :
+        PENDING ? ((s - GestureTable::STATE_DOWN) % (GestureTable::BUTTONS * GestureTable::MAX_CLICKS)) /
+            GestureTable::MAX_CLICKS : 0;
+    static const int CLICKS = PENDING ? (s - GestureTable::STATE_DOWN) % GestureTable::MAX_CLICKS + 1 : 0;
+};
+
+// a transition under construction, out packs the codes, first in the low byte
+template <int NEXT, int TIMER, int FLAGS, int OUT>
+struct GestureStep
+{
+    static const int next = NEXT;
+    static const int timer = TIMER;
+    static const int flags = FLAGS;
+    static const int out = OUT;
+};
+
+template <class T, int a>
+struct GestureAppend
+{
+    static const int code = a & 0xff;
+    static const int len = T::out == 0 ? 0 : (T::out >> 8) == 0 ? 1 : (T::out >> 16) == 0 ? 2 :
+        (T::out >> 24) == 0 ? 3 : 4;
+    typedef GestureStep<T::next, T::timer,
+            T::flags | ((a & GESTURE_QUIT) ? GestureTable::FLAG_QUIT : 0),
+            (code != 0 && len < GestureTable::OUT_SIZE - 1) ? T::out | (code << (8 * len)) : T::out> type;
+};
+
+template <bool c, class A, class B>
+struct GestureSelect
+{
+    typedef A type;
+};
+
+template <class A, class B>
+struct GestureSelect<false, A, B>
+{
+    typedef B type;
+};
+
+// the pending click of s decided as it is, if c
+template <class S, int s, bool c, class T>
+struct GestureResolve
+{
+    typedef GestureState<s> St;
+    typedef typename GestureAppend<T, c ? GestureClick<S, St::BUTTON, St::CLICKS>::value : 0>::type A;
+    typedef GestureStep<c ? (St::DOWN ? GestureTable::STATE_HELD + St::BUTTON : GestureTable::STATE_IDLE) : A::next,
+            c ? GestureTable::TIMER_OFF : A::timer, A::flags, A::out> type;
+};
+
+// press number n of b
+template <class S, int b, int n, class T>
+struct GestureEnter
+{
+    typedef GestureBinding<S, b> B;
+    typedef GestureClick<S, b, n> C;
+    typedef GestureStep<T::next, T::timer,
+            T::flags | GestureTable::FLAG_PRESS | (n == 1 ? GestureTable::FLAG_FIRST : 0), T::out> T1;
+    typedef typename GestureAppend<T1, B::PRESS>::type T2;
+    typedef typename GestureAppend<T2, (n == 1 && B::SPECULATIVE) ? B::CLICK1 : 0>::type T3;
+    typedef typename GestureAppend<T3, C::FINAL ? C::value : 0>::type T4;
+    typedef GestureStep<C::FINAL ? GestureTable::STATE_HELD + b :
+                GestureTable::STATE_DOWN + b * GestureTable::MAX_CLICKS + n - 1,
+            C::FINAL ? GestureTable::TIMER_OFF :
+                (n == 1 && B::LONG != 0) ? GestureTable::TIMER_LONG : GestureTable::TIMER_CLICK,
+            T4::flags, T4::out> type;
+};
+
+template <class S, int s, int b>
+struct GesturePress
+{
+    typedef GestureState<s> St;
+    typedef GestureBinding<S, b> B;
+    typedef GestureStep<s, GestureTable::TIMER_KEEP, 0, 0> Nop;
+    static const bool RESOLVE = S::MOTION_RESOLVE > 0;
+    static const bool SAME = St::PENDING && St::BUTTON == b;
+    static const int CHORD = GestureChord<S, St::BUTTON, b>::value;
+
+    typedef typename GestureAppend<typename GestureAppend<
+            typename GestureResolve<S, s, RESOLVE && St::PENDING, Nop>::type,
+            B::PRESS>::type, B::CLICK1>::type Instant;
+    typedef typename GestureAppend<Nop, B::PRESS>::type Held;
+    typedef typename GestureSelect<St::DOWN || St::CLICKS >= GestureTable::MAX_CLICKS, Nop,
+            typename GestureEnter<S, b, St::CLICKS + 1,
+                GestureStep<s, GestureTable::TIMER_KEEP,
+                    St::CLICKS == 1 ? GestureTable::FLAG_SAMPLE : 0, 0> >::type>::type Same;
+    typedef typename GestureAppend<GestureStep<GestureTable::STATE_HELD + St::BUTTON,
+            GestureTable::TIMER_OFF, 0, 0>, CHORD>::type Chord;
+    typedef typename GestureEnter<S, b, 1,
+            typename GestureResolve<S, s, St::PENDING, Nop>::type>::type First;
+
+    typedef typename GestureSelect<B::IS_INSTANT, Instant,
+            typename GestureSelect<St::HELD, Held,
+            typename GestureSelect<SAME, Same,
+            typename GestureSelect<St::PENDING && CHORD != 0, Chord, First>::type>::type>::type>::type type;
+};
+
+template <class S, int s, int b>
+struct GestureRelease
+{
+    typedef GestureState<s> St;
+    typedef GestureBinding<S, b> B;
+    typedef typename GestureAppend<GestureStep<s, GestureTable::TIMER_KEEP, 0, 0>, B::RELEASE>::type T0;
+    static const bool OWN = St::DOWN && St::BUTTON == b;
+    // waited for a long press or chord only
+    static const bool DONE = St::CLICKS >= B::MAX_CLICKS;
+
+    typedef GestureStep<GestureTable::STATE_IDLE, T0::timer, T0::flags | GestureTable::FLAG_ALL_UP, T0::out> Held;
+    typedef typename GestureAppend<GestureStep<GestureTable::STATE_IDLE, GestureTable::TIMER_OFF, T0::flags, T0::out>,
+            GestureClick<S, b, St::CLICKS>::value>::type Done;
+    typedef GestureStep<GestureTable::STATE_UP + b * GestureTable::MAX_CLICKS + St::CLICKS - 1,
+            (St::CLICKS == 1 && B::LONG != 0) ? GestureTable::TIMER_CLICK : GestureTable::TIMER_KEEP,
+            T0::flags, T0::out> Up;
+
+    typedef typename GestureSelect<St::HELD, Held,
+            typename GestureSelect<OWN && DONE, Done,
+            typename GestureSelect<OWN, Up, T0>::type>::type>::type type;
+};
+
+// wheel
+template <class S, int s, int a>
+struct GestureOther
+{
+    typedef typename GestureAppend<typename GestureResolve<S, s,
+            (S::MOTION_RESOLVE > 0 && GestureState<s>::PENDING),
+            GestureStep<s, GestureTable::TIMER_KEEP, 0, 0> >::type, a>::type type;
+};
+
+template <class S, int s>
+struct GestureTimeout
+{
+    typedef GestureState<s> St;
+    typedef GestureStep<s, GestureTable::TIMER_KEEP, 0, 0> Nop;
+    static const int LONG = GestureBinding<S, St::BUTTON>::LONG;
+
+    typedef typename GestureAppend<GestureStep<GestureTable::STATE_HELD + St::BUTTON,
+            GestureTable::TIMER_OFF, 0, 0>, LONG>::type Long;
+    typedef typename GestureResolve<S, s, true, Nop>::type R;
+    typedef GestureStep<R::next, R::timer,
+            R::flags | (St::CLICKS == 1 ? GestureTable::FLAG_SINGLE : 0), R::out> Single;
+
+    typedef typename GestureSelect<!St::PENDING, Nop,
+            typename GestureSelect<St::DOWN && St::CLICKS == 1 && LONG != 0, Long, Single>::type>::type type;
+};
+
+template <class S, int s, int sym>
+struct GestureTransition
+{
+    typedef typename GestureSelect<(sym < GestureTable::SYM_UP),
+                typename GesturePress<S, s, sym % GestureTable::BUTTONS>::type,
+            typename GestureSelect<(sym < GestureTable::SYM_WHEEL_DOWN),
+                typename GestureRelease<S, s, sym % GestureTable::BUTTONS>::type,
+            typename GestureSelect<(sym == GestureTable::SYM_WHEEL_DOWN),
+                typename GestureOther<S, s, S::WHEEL_DOWN>::type,
+            typename GestureSelect<(sym == GestureTable::SYM_WHEEL_UP),
+                typename GestureOther<S, s, S::WHEEL_UP>::type,
+            typename GestureSelect<(sym == GestureTable::SYM_MOTION),
+                typename GestureResolve<S, s, (S::MOTION_RESOLVE > 0 && GestureState<s>::PENDING),
+                    GestureStep<s, GestureTable::TIMER_KEEP, 0, 0> >::type,
+                typename GestureTimeout<S, s>::type
+            >::type>::type>::type>::type>::type type;
+};
+
+// one transition as constants
+template <class S, int s, int sym>
+struct GestureEntry
+{
+    typedef typename GestureTransition<S, s, sym>::type T;
+    static const int next = T::next;
+    static const int timer = T::timer;
+    static const int flags = T::flags;
+    static const char out0 = T::out & 0xff;
+    static const char out1 = (T::out >> 8) & 0xff;
+    static const char out2 = (T::out >> 16) & 0xff;
+    static const char out3 = (T::out >> 24) & 0xff;
+};
+
+// same interface as GestureTable for ButtonProcess
+template <class S>
+class StaticGestureTable
+{
+    public:
+        enum { MOTION_RESOLVE = S::MOTION_RESOLVE };
+
+    public:
+        const GestureTable::transition &Lookup(int state, int sym) const
+        {
+            return s_table[state][sym];
+        }
+
+        tick_t LongTicks() const
+        {
+            return (tick_t)S::LONG_MS * TICKS_PER_MS;
+        }
+
+        char Scroll(int i) const
+        {
+            return s_scroll[i];
+        }
+
+    private:
+        static const GestureTable::transition s_table[GestureTable::STATES][GestureTable::SYMBOLS];
+        static const char s_scroll[GestureTable::SCROLLS];
+};
+
+template <class S>
+const char StaticGestureTable<S>::s_scroll[GestureTable::SCROLLS] = {
+    (char)S::WHEEL_LEFT, (char)S::WHEEL_RIGHT,
+    (char)S::FINE_DOWN, (char)S::FINE_UP, (char)S::FINE_LEFT, (char)S::FINE_RIGHT
+};
+
+// the rows below spell out every state and symbol
+typedef char gesture_table_size_check[(GestureTable::STATES == 22 && GestureTable::SYMBOLS == 10) ? 1 : -1];
+
+#define GESTURE_ROWS(ROW) \
+    ROW(0) ROW(1) ROW(2) ROW(3) ROW(4) ROW(5) ROW(6) ROW(7) ROW(8) ROW(9) ROW(10) \
+    ROW(11) ROW(12) ROW(13) ROW(14) ROW(15) ROW(16) ROW(17) ROW(18) ROW(19) ROW(20) ROW(21)
+#define GESTURE_COLUMNS(COLUMN, s) \
+    COLUMN(s, 0) COLUMN(s, 1) COLUMN(s, 2) COLUMN(s, 3) COLUMN(s, 4) \
+    COLUMN(s, 5) COLUMN(s, 6) COLUMN(s, 7) COLUMN(s, 8) COLUMN(s, 9)
+
+#define GESTURE_ENTRY(s, sym) \
+    { GestureEntry<S, s, sym>::next, GestureEntry<S, s, sym>::timer, GestureEntry<S, s, sym>::flags, \
+      { GestureEntry<S, s, sym>::out0, GestureEntry<S, s, sym>::out1, \
+        GestureEntry<S, s, sym>::out2, GestureEntry<S, s, sym>::out3, '\0' } },
+#define GESTURE_ENTRY_ROW(s) { GESTURE_COLUMNS(GESTURE_ENTRY, s) },
+
+template <class S>
+const GestureTable::transition StaticGestureTable<S>::s_table[GestureTable::STATES][GestureTable::SYMBOLS] = {
+    GESTURE_ROWS(GESTURE_ENTRY_ROW)
+};
+
+#undef GESTURE_ENTRY_ROW
+#undef GESTURE_ENTRY
+#undef GESTURE_COLUMNS
+#undef GESTURE_ROWS
+
+#endif
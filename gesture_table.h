@@ -0,0 +1,633 @@
+// @brief: gesture bindings compiled into a dense transition table
+//
+// a binding names the action code a gesture sends: N clicks, long press,
+// press and release edges, chords of two buttons and the wheel. bindings
+// are built in or read from a config file, and compiled once at startup
+// into a table indexed by (state, input symbol). an input event costs one
+// lookup, the codes a transition sends are stored with it
+//
+// config file, one binding per line, # starts a comment:
+//    click left <            single click, the window closed
+//    double left z           double click, triple for three clicks
+//    long left L             held for the long press time
+//    press left a            every press edge of the button
+//    release left b          every release edge of the button
+//    upgrade left Z          double click after the single click was sent at
+//                            once (-S), double is sent if not bound
+//    chord left right q quit other button while the first one is held or its
+//                            click is pending, quit exits the program
+//    wheel down 9
+//    wheel up 0
+//    wheel left [            horizontal wheel, right too
+//    fine down j             every fine step of a high resolution wheel (-f),
+//                            up, left and right too
+//    longtime 600            long press time in ms
+// buttons are left, right and middle, codes are one printable character.
+// horizontal detents and fine steps go out without a table lookup, they
+// do not resolve a pending click
+
+#ifndef GESTURE_TABLE_H
+#define GESTURE_TABLE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+
+class GestureTable
+{
+    public:
+        // BTN_* names are taken by linux/input.h
+        enum {
+            BUTTON_LEFT,
+            BUTTON_RIGHT,
+            BUTTON_MIDDLE,
+            BUTTONS
+        };
+
+        enum { MAX_CLICKS = 3 };
+
+        // input symbols
+        enum {
+            SYM_DOWN,                               // + button
+            SYM_UP = SYM_DOWN + BUTTONS,            // + button
+            SYM_WHEEL_DOWN = SYM_UP + BUTTONS,
+            SYM_WHEEL_UP,
+            SYM_MOTION,     // moved motion_resolve since the pending click
+            SYM_TIMEOUT,    // timer of the pending click expired
+            SYMBOLS
+        };
+
+        // codes sent without a table lookup, see Scroll()
+        enum {
+            SCROLL_LEFT,
+            SCROLL_RIGHT,
+            SCROLL_FINE_DOWN,
+            SCROLL_FINE_UP,
+            SCROLL_FINE_LEFT,
+            SCROLL_FINE_RIGHT,
+            SCROLLS
+        };
+
+        // states, a pending click is (button, clicks so far) and held or released
+        enum {
+            STATE_IDLE,
+            STATE_DOWN,                                     // + button * MAX_CLICKS + clicks - 1
+            STATE_UP = STATE_DOWN + BUTTONS * MAX_CLICKS,   // likewise
+            STATE_HELD = STATE_UP + BUTTONS * MAX_CLICKS,   // + button, gesture done, wait release
+            STATES = STATE_HELD + BUTTONS
+        };
+
+        // timer after a transition
+        enum {
+            TIMER_KEEP,
+            TIMER_OFF,
+            TIMER_CLICK,    // click window from the last press
+            TIMER_LONG      // long press time from the last press
+        };
+
+        // transition flags
+        enum {
+            FLAG_PRESS = 1,     // a click starts, remember its time
+            FLAG_FIRST = 2,     // first click of a gesture
+            FLAG_SAMPLE = 4,    // second click of a double click
+            FLAG_SINGLE = 8,    // single click timed out
+            FLAG_ALL_UP = 16,   // go to next only once no button is held
+            FLAG_QUIT = 32      // program exits
+        };
+
+        enum {
+            OUT_SIZE = 5,       // codes of one transition, NUL terminated
+            LONG_TICKS = 600 * TICKS_PER_MS
+        };
+
+        struct transition
+        {
+            uint8_t next;
+            uint8_t timer;
+            uint8_t flags;
+            char out[OUT_SIZE];
+        };
+
+    public:
+        GestureTable()
+        :m_tick_long(LONG_TICKS)
+        {
+            Clear();
+        }
+
+        // the actions of mouse_capture.cpp
+        void Default()
+        {
+            Clear();
+            m_click[BUTTON_LEFT][0].code = '<';
+            m_click[BUTTON_LEFT][1].code = 'z';
+            m_click[BUTTON_RIGHT][0].code = '>';
+            m_click[BUTTON_RIGHT][1].code = 'x';
+            m_click[BUTTON_MIDDLE][0].code = 'p';
+            m_upgrade[BUTTON_LEFT].code = 'Z';
+            m_upgrade[BUTTON_RIGHT].code = 'X';
+            m_chord[BUTTON_LEFT][BUTTON_RIGHT].code = 'q';
+            m_chord[BUTTON_LEFT][BUTTON_RIGHT].bQuit = true;
+            m_chord[BUTTON_RIGHT][BUTTON_LEFT] = m_chord[BUTTON_LEFT][BUTTON_RIGHT];
+            m_wheel[0].code = '9';
+            m_wheel[1].code = '0';
+            m_scroll[SCROLL_LEFT].code = '[';
+            m_scroll[SCROLL_RIGHT].code = ']';
+            m_scroll[SCROLL_FINE_DOWN].code = 'j';
+            m_scroll[SCROLL_FINE_UP].code = 'k';
+            m_scroll[SCROLL_FINE_LEFT].code = 'h';
+            m_scroll[SCROLL_FINE_RIGHT].code = 'l';
+        }
+
+        // bindings of a config file replace all others,
+        // false on a missing file or a bad line
+        bool Load(const char *path)
+        {
+            FILE *fp = fopen(path, "r");
+            if (fp == NULL)
+            {
+                return false;
+            }
+
+            Clear();
+            char line[128];
+            while (fgets(line, sizeof(line), fp))
+            {
+                char *p = strchr(line, '#');
+                if (p)
+                {
+                    *p = '\0';
+                }
+                if (!Parse(line))
+                {
+                    fclose(fp);
+                    return false;
+                }
+            }
+            fclose(fp);
+            return true;
+        }
+
+        tick_t LongTicks() const
+        {
+            return m_tick_long;
+        }
+
+        // code of SCROLL_*, 0 if not bound
+        char Scroll(int i) const
+        {
+            return m_scroll[i].code;
+        }
+
+        // build the table. speculative per button sends the single click at
+        // once, bResolve resolves a pending click on motion, wheel and other
+        // buttons
+        void Compile(const bool speculative[BUTTONS], bool bResolve)
+        {
+            for (int b = 0; b < BUTTONS; b++)
+            {
+                m_bSpeculative[b] = speculative[b];
+            }
+            m_bResolve = bResolve;
+
+            for (int s = 0; s < STATES; s++)
+            {
+                for (int sym = 0; sym < SYMBOLS; sym++)
+                {
+                    // nothing happens
+                    transition &t = m_table[s][sym];
+                    t.next = s;
+                    t.timer = TIMER_KEEP;
+                    t.flags = 0;
+                    t.out[0] = '\0';
+                }
+
+                for (int b = 0; b < BUTTONS; b++)
+                {
+                    Press(s, b, m_table[s][SYM_DOWN + b]);
+                    Release(s, b, m_table[s][SYM_UP + b]);
+                }
+                Other(s, m_wheel[0], m_table[s][SYM_WHEEL_DOWN]);
+                Other(s, m_wheel[1], m_table[s][SYM_WHEEL_UP]);
+                if (m_bResolve && IsPending(s))
+                {
+                    Resolve(s, m_table[s][SYM_MOTION]);
+                }
+                Timeout(s, m_table[s][SYM_TIMEOUT]);
+            }
+        }
+
+        const transition &Lookup(int state, int sym) const
+        {
+            return m_table[state][sym];
+        }
+
+        // button of a pending or held state
+        static int Button(int state)
+        {
+            if (state >= STATE_HELD)
+            {
+                return state - STATE_HELD;
+            }
+            return ((state - STATE_DOWN) % (BUTTONS * MAX_CLICKS)) / MAX_CLICKS;
+        }
+
+    private:
+        struct action
+        {
+            char code;
+            bool bQuit;
+        };
+
+        void Clear()
+        {
+            memset(m_click, 0, sizeof(m_click));
+            memset(m_long, 0, sizeof(m_long));
+            memset(m_press, 0, sizeof(m_press));
+            memset(m_release, 0, sizeof(m_release));
+            memset(m_upgrade, 0, sizeof(m_upgrade));
+            memset(m_chord, 0, sizeof(m_chord));
+            memset(m_wheel, 0, sizeof(m_wheel));
+            memset(m_scroll, 0, sizeof(m_scroll));
+        }
+
+        static int ParseButton(const char *name)
+        {
+            if (strcmp(name, "left") == 0)
+            {
+                return BUTTON_LEFT;
+            }
+            else if (strcmp(name, "right") == 0)
+            {
+                return BUTTON_RIGHT;
+            }
+            else if (strcmp(name, "middle") == 0)
+            {
+                return BUTTON_MIDDLE;
+            }
+            return -1;
+        }
+
+        // one line without comment
+        bool Parse(const char *line)
+        {
+            char kind[16], arg1[16], arg2[16], arg3[16], arg4[16];
+            int n = sscanf(line, "%15s %15s %15s %15s %15s", kind, arg1, arg2, arg3, arg4);
+            if (n <= 0)
+            {
+                // empty
+                return true;
+            }
+
+            if (strcmp(kind, "longtime") == 0)
+            {
+                int ms = 0;
+                if (n != 2 || sscanf(arg1, "%d", &ms) != 1 || ms <= 0)
+                {
+                    return false;
+                }
+                m_tick_long = (tick_t)ms * TICKS_PER_MS;
+                return true;
+            }
+
+            if (strcmp(kind, "wheel") == 0)
+            {
+                if (strcmp(arg1, "left") == 0 || strcmp(arg1, "right") == 0)
+                {
+                    return n == 3 && SetAction(m_scroll[arg1[0] == 'l' ? SCROLL_LEFT : SCROLL_RIGHT], arg2, NULL);
+                }
+                int i = strcmp(arg1, "down") == 0 ? 0 : (strcmp(arg1, "up") == 0 ? 1 : -1);
+                return n >= 3 && i != -1 && SetAction(m_wheel[i], arg2, n >= 4 ? arg3 : NULL);
+            }
+
+            if (strcmp(kind, "fine") == 0)
+            {
+                static const char *dirs[] = { "down", "up", "left", "right" };
+                for (int i = 0; i < 4; i++)
+                {
+                    if (n >= 2 && strcmp(arg1, dirs[i]) == 0)
+                    {
+                        return n == 3 && SetAction(m_scroll[SCROLL_FINE_DOWN + i], arg2, NULL);
+                    }
+                }
+                return false;
+            }
+
+            int b = n >= 2 ? ParseButton(arg1) : -1;
+            if (b == -1 || n < 3)
+            {
+                return false;
+            }
+            const char *quit = n >= 4 ? arg3 : NULL;
+            if (strcmp(kind, "click") == 0)
+            {
+                return SetAction(m_click[b][0], arg2, quit);
+            }
+            else if (strcmp(kind, "double") == 0)
+            {
+                return SetAction(m_click[b][1], arg2, quit);
+            }
+            else if (strcmp(kind, "triple") == 0)
+            {
+                return SetAction(m_click[b][2], arg2, quit);
+            }
+            else if (strcmp(kind, "long") == 0)
+            {
+                return SetAction(m_long[b], arg2, quit);
+            }
+            else if (strcmp(kind, "press") == 0)
+            {
+                return SetAction(m_press[b], arg2, quit);
+            }
+            else if (strcmp(kind, "release") == 0)
+            {
+                return SetAction(m_release[b], arg2, quit);
+            }
+            else if (strcmp(kind, "upgrade") == 0)
+            {
+                return SetAction(m_upgrade[b], arg2, quit);
+            }
+            else if (strcmp(kind, "chord") == 0)
+            {
+                int b2 = ParseButton(arg2);
+                if (b2 == -1 || b2 == b || n < 4 ||
+                    !SetAction(m_chord[b][b2], arg3, n >= 5 ? arg4 : NULL))
+                {
+                    return false;
+                }
+                m_chord[b2][b] = m_chord[b][b2];
+                return true;
+            }
+            return false;
+        }
+
+        static bool SetAction(action &a, const char *code, const char *quit)
+        {
+            if (strlen(code) != 1 || code[0] <= ' ' || code[0] > '~')
+            {
+                return false;
+            }
+            if (quit && strcmp(quit, "quit") != 0)
+            {
+                return false;
+            }
+            a.code = code[0];
+            a.bQuit = quit != NULL;
+            return true;
+        }
+
+        static bool IsPending(int state)
+        {
+            return state >= STATE_DOWN && state < STATE_HELD;
+        }
+
+        static bool IsDown(int state)
+        {
+            return state >= STATE_DOWN && state < STATE_UP;
+        }
+
+        static int Clicks(int state)
+        {
+            return (state - STATE_DOWN) % MAX_CLICKS + 1;
+        }
+
+        static int Down(int b, int n)
+        {
+            return STATE_DOWN + b * MAX_CLICKS + n - 1;
+        }
+
+        static int Up(int b, int n)
+        {
+            return STATE_UP + b * MAX_CLICKS + n - 1;
+        }
+
+        // highest bound click count
+        int MaxClicks(int b) const
+        {
+            for (int n = MAX_CLICKS; n > 0; n--)
+            {
+                if (m_click[b][n - 1].code)
+                {
+                    return n;
+                }
+            }
+            return 0;
+        }
+
+        bool IsChord(int b) const
+        {
+            for (int i = 0; i < BUTTONS; i++)
+            {
+                if (m_chord[b][i].code)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // a press that needs no state: at most a single click and nothing
+        // that waits for the button
+        bool IsInstant(int b) const
+        {
+            return MaxClicks(b) <= 1 && !m_long[b].code && !IsChord(b);
+        }
+
+        // the press can not tell anything more, n clicks are final
+        bool IsFinal(int b, int n) const
+        {
+            return n >= MaxClicks(b) && !(n == 1 && (m_long[b].code || IsChord(b)));
+        }
+
+        // action of n clicks of b when they are decided
+        const action &ClickAction(int b, int n) const
+        {
+            static const action none = { '\0', false };
+            if (m_bSpeculative[b] && MaxClicks(b) > 1)
+            {
+                if (n == 1)
+                {
+                    // sent already with the press
+                    return none;
+                }
+                if (n == 2 && m_upgrade[b].code)
+                {
+                    return m_upgrade[b];
+                }
+            }
+            return m_click[b][n - 1];
+        }
+
+        static void Append(transition &t, const action &a)
+        {
+            if (a.code == '\0')
+            {
+                return;
+            }
+            size_t nLen = strlen(t.out);
+            if (nLen < OUT_SIZE - 1)
+            {
+                t.out[nLen] = a.code;
+                t.out[nLen + 1] = '\0';
+            }
+            if (a.bQuit)
+            {
+                t.flags |= FLAG_QUIT;
+            }
+        }
+
+        // the pending click of state is decided as it is
+        void Resolve(int state, transition &t)
+        {
+            int b = Button(state);
+            Append(t, ClickAction(b, Clicks(state)));
+            t.next = IsDown(state) ? STATE_HELD + b : STATE_IDLE;
+            t.timer = TIMER_OFF;
+        }
+
+        // press number n of b
+        void Enter(int b, int n, transition &t)
+        {
+            t.flags |= FLAG_PRESS | (n == 1 ? FLAG_FIRST : 0);
+            Append(t, m_press[b]);
+            if (n == 1 && m_bSpeculative[b] && MaxClicks(b) > 1)
+            {
+                Append(t, m_click[b][0]);
+            }
+
+            if (IsFinal(b, n))
+            {
+                Append(t, ClickAction(b, n));
+                t.next = STATE_HELD + b;
+                t.timer = TIMER_OFF;
+            }
+            else
+            {
+                t.next = Down(b, n);
+                t.timer = (n == 1 && m_long[b].code) ? TIMER_LONG : TIMER_CLICK;
+            }
+        }
+
+        void Press(int s, int b, transition &t)
+        {
+            if (IsInstant(b))
+            {
+                if (m_bResolve && IsPending(s))
+                {
+                    Resolve(s, t);
+                }
+                Append(t, m_press[b]);
+                Append(t, m_click[b][0]);
+                return;
+            }
+
+            if (s >= STATE_HELD)
+            {
+                // gesture is done until every button is up
+                Append(t, m_press[b]);
+                return;
+            }
+
+            if (IsPending(s))
+            {
+                int pending = Button(s);
+                if (pending == b)
+                {
+                    // released, (b, MAX_CLICKS) is never pending
+                    if (!IsDown(s) && Clicks(s) < MAX_CLICKS)
+                    {
+                        int n = Clicks(s) + 1;
+                        t.flags |= (n == 2 ? FLAG_SAMPLE : 0);
+                        Enter(b, n, t);
+                    }
+                    return;
+                }
+                if (m_chord[pending][b].code)
+                {
+                    Append(t, m_chord[pending][b]);
+                    t.next = STATE_HELD + pending;
+                    t.timer = TIMER_OFF;
+                    return;
+                }
+                // a new gesture
+                Resolve(s, t);
+            }
+            Enter(b, 1, t);
+        }
+
+        void Release(int s, int b, transition &t)
+        {
+            Append(t, m_release[b]);
+            if (s >= STATE_HELD)
+            {
+                t.next = STATE_IDLE;
+                t.flags |= FLAG_ALL_UP;
+            }
+            else if (IsDown(s) && Button(s) == b)
+            {
+                int n = Clicks(s);
+                if (n >= MaxClicks(b))
+                {
+                    // waited for a long press or chord only
+                    Append(t, ClickAction(b, n));
+                    t.next = STATE_IDLE;
+                    t.timer = TIMER_OFF;
+                }
+                else
+                {
+                    t.next = Up(b, n);
+                    // the long press timer ran, back to the click window
+                    t.timer = (n == 1 && m_long[b].code) ? TIMER_CLICK : TIMER_KEEP;
+                }
+            }
+        }
+
+        // wheel
+        void Other(int s, const action &a, transition &t)
+        {
+            if (m_bResolve && IsPending(s))
+            {
+                Resolve(s, t);
+            }
+            Append(t, a);
+        }
+
+        void Timeout(int s, transition &t)
+        {
+            if (!IsPending(s))
+            {
+                return;
+            }
+
+            int b = Button(s);
+            int n = Clicks(s);
+            if (IsDown(s) && n == 1 && m_long[b].code)
+            {
+                Append(t, m_long[b]);
+                t.next = STATE_HELD + b;
+                t.timer = TIMER_OFF;
+                return;
+            }
+            Resolve(s, t);
+            t.flags |= (n == 1 ? FLAG_SINGLE : 0);
+        }
+
+    private:
+        action m_click[BUTTONS][MAX_CLICKS];
+        action m_long[BUTTONS];
+        action m_press[BUTTONS];
+        action m_release[BUTTONS];
+        action m_upgrade[BUTTONS];
+        action m_chord[BUTTONS][BUTTONS];
+        action m_wheel[2];  // down, up
+        action m_scroll[SCROLLS];
+        tick_t m_tick_long;
+
+        bool m_bSpeculative[BUTTONS];
+        bool m_bResolve;
+        transition m_table[STATES][SYMBOLS];
+};
+
+#endif
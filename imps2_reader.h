@@ -0,0 +1,452 @@
+// @brief: batched reader for the PS/2 byte streams of /dev/input/mice
+// @see: linux kernel drivers/input/mousedev.c, drivers/input/mouse/psmouse-base.c
+//       http://www.computer-engineering.org/ps2mouse/
+//
+// the protocol is probed once at startup (Ps2Probe) and picks one
+// Ps2Reader<P> instance: plain PS/2 has 3 byte packets, IMPS/2 adds a
+// wheel byte, ExplorerPS/2 packs the wheel, buttons 4/5 and the
+// horizontal wheel of the IntelliMouse Explorer 4.0 into the fourth byte.
+// every P decodes a fixed size packet without asking which protocol it is
+
+#ifndef IMPS2_READER_H
+#define IMPS2_READER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "capture_log.h"
+#include "flight_recorder.h"
+#include "runtime_counters.h"
+
+typedef unsigned char BYTE;
+
+#pragma pack(1)
+struct imps2_data
+{
+    BYTE btn_left:1;
+    BYTE btn_right:1;
+    BYTE btn_middle:1;
+    BYTE NONE:1;
+    BYTE x_sign:1;  // x offset sign
+    BYTE y_sign:1;  // y offset sign
+    BYTE x_overflow:1; // x offset is overflow
+    BYTE y_overflow:1; // y offset is overflow
+
+    // x/y movement offset relative to its position
+    signed char x;
+    signed char y;
+    signed char z;
+};
+#pragma pack()
+
+// 3 byte packets, buttons and 9 bit deltas
+struct Ps2Protocol
+{
+    enum { SIZE = 3, ID = 0 };
+
+    static void Decode(const BYTE *p, tick_t time, mouse_report &report)
+    {
+        report.btn_left = p[0] & 0x01;
+        report.btn_right = p[0] & 0x02;
+        report.btn_middle = p[0] & 0x04;
+        report.btn_side = false;
+        report.btn_extra = false;
+        // the sign bits of the first byte are the 9th bit
+        report.x = (int)p[1] - ((p[0] << 4) & 0x100);
+        report.y = (int)p[2] - ((p[0] << 3) & 0x100);
+        report.z = 0;
+        report.z_hires = 0;
+        report.w_hires = 0;
+        report.time = time;
+    }
+};
+
+// IMPS/2, imps2_data with a signed wheel byte
+struct Imps2Protocol
+{
+    enum { SIZE = 4, ID = 3 };
+
+    static void Decode(const BYTE *p, tick_t time, mouse_report &report)
+    {
+        imps2_data data;
+        memcpy(&data, p, sizeof(data));
+        report.btn_left = data.btn_left;
+        report.btn_right = data.btn_right;
+        report.btn_middle = data.btn_middle;
+        report.btn_side = false;
+        report.btn_extra = false;
+        report.x = data.x;
+        report.y = data.y;
+        report.z = data.z;
+        report.z_hires = data.z * WheelAccumulator::UNITS_PER_DETENT;
+        report.w_hires = 0;
+        report.time = time;
+    }
+};
+
+// ExplorerPS/2, the fourth byte is a 4 bit wheel with buttons 4/5 in
+// bits 4/5, or a 6 bit vertical (10b) or horizontal (01b) wheel
+struct ExplorerProtocol
+{
+    enum { SIZE = 4, ID = 4 };
+
+    static void Decode(const BYTE *p, tick_t time, mouse_report &report)
+    {
+        Ps2Protocol::Decode(p, time, report);
+
+        int w = 0;
+        switch (p[3] & 0xc0)
+        {
+            case 0x80:
+                report.z = (int)(p[3] & 0x1f) - (int)(p[3] & 0x20);
+                break;
+            case 0x40:
+                // > 0 right
+                w = (int)(p[3] & 0x20) - (int)(p[3] & 0x1f);
+                break;
+            default:
+                report.z = (int)(p[3] & 0x07) - (int)(p[3] & 0x08);
+                report.btn_side = p[3] & 0x10;
+                report.btn_extra = p[3] & 0x20;
+                break;
+        }
+        report.z_hires = report.z * WheelAccumulator::UNITS_PER_DETENT;
+        report.w_hires = w * WheelAccumulator::UNITS_PER_DETENT;
+    }
+};
+
+// drain the fd into a ring buffer with one read, then cut P::SIZE frames
+// in user space. frames are aligned on the always set bit 3 of the first
+// byte, command ACK bytes are skipped, so a short read never shifts the
+// stream
+template <class P>
+class Ps2Reader
+{
+    public:
+        enum {
+            RING_SIZE = 512,    // power of two
+            PS2_ACK = 0xfa,
+            FRAME_SYNC = 0x08   // NONE bit, always 1 in the first byte
+        };
+
+    public:
+        Ps2Reader(int fd)
+        :m_fd(fd),
+        m_head(0),
+        m_tail(0),
+        m_pFlight(NULL),
+        m_pCounters(NULL)
+        {
+        }
+
+        // raw frames and skipped bytes for the postmortem, NULL is off
+        void SetFlight(FlightRecorder *pFlight)
+        {
+            m_pFlight = pFlight;
+        }
+
+        // reads, skipped bytes and overflows, NULL is off
+        void SetCounters(RuntimeCounters *pCounters)
+        {
+            m_pCounters = pCounters;
+        }
+
+        // one read into the free space of the ring,
+        // return bytes read, 0 is end of file, -1 is error (see errno)
+        int Fill()
+        {
+            unsigned nFree = RING_SIZE - (m_head - m_tail);
+            if (nFree == 0)
+            {
+                // caller does not consume frames, drop the oldest byte to resync
+                m_tail++;
+                nFree = 1;
+            }
+
+            unsigned nPos = m_head & (RING_SIZE - 1);
+            unsigned nFirst = RING_SIZE - nPos;
+            if (nFirst > nFree)
+            {
+                nFirst = nFree;
+            }
+
+            struct iovec iov[2];
+            iov[0].iov_base = m_ring + nPos;
+            iov[0].iov_len = nFirst;
+            iov[1].iov_base = m_ring;
+            iov[1].iov_len = nFree - nFirst;
+
+            ssize_t nLen = readv(m_fd, iov, iov[1].iov_len ? 2 : 1);
+            if (nLen > 0)
+            {
+                m_head += nLen;
+            }
+            if (m_pCounters)
+            {
+                Count(nLen);
+            }
+            return nLen;
+        }
+
+        // the nLen bytes of the last Fill() to the capture log
+        void Log(CaptureLog &log, unsigned nLen, tick_t time)
+        {
+            unsigned nPos = (m_head - nLen) & (RING_SIZE - 1);
+            unsigned nFirst = RING_SIZE - nPos;
+            if (nFirst > nLen)
+            {
+                nFirst = nLen;
+            }
+            log.Ps2(m_ring + nPos, nFirst, time);
+            if (nLen > nFirst)
+            {
+                log.Ps2(m_ring, nLen - nFirst, time);
+            }
+        }
+
+        // bytes of a replayed read instead of Fill()
+        void Feed(const BYTE *p, unsigned nLen)
+        {
+            for (unsigned i = 0; i < nLen; i++)
+            {
+                if (m_head - m_tail == (unsigned)RING_SIZE)
+                {
+                    m_tail++;
+                }
+                m_ring[m_head++ & (RING_SIZE - 1)] = p[i];
+            }
+        }
+
+        // drop what the ring holds, a partial frame of a stream that ended
+        void Reset()
+        {
+            m_head = 0;
+            m_tail = 0;
+        }
+
+        // bytes in the ring, a partial frame once Next() returned false
+        unsigned Pending() const
+        {
+            return m_head - m_tail;
+        }
+
+        // next complete frame, false if the ring holds no complete frame.
+        // mousedev has no timestamps, time is the read time
+        bool Next(mouse_report &report, tick_t time)
+        {
+            while (m_head != m_tail)
+            {
+                BYTE first = m_ring[m_tail & (RING_SIZE - 1)];
+                if (first == PS2_ACK || !(first & FRAME_SYNC))
+                {
+                    // ack or out of sync, skip byte
+                    if (m_pFlight)
+                    {
+                        m_pFlight->Record(FlightRecorder::FLIGHT_SKIP, time, 0, first);
+                    }
+                    if (m_pCounters)
+                    {
+                        m_pCounters->Add(first == PS2_ACK ? RuntimeCounters::ACK_BYTES : RuntimeCounters::SYNC_BYTES);
+                    }
+                    m_tail++;
+                    continue;
+                }
+
+                if (m_head - m_tail < (unsigned)P::SIZE)
+                {
+                    // wait for the rest of frame
+                    return false;
+                }
+
+                BYTE frame[P::SIZE];
+                for (unsigned i = 0; i < (unsigned)P::SIZE; i++)
+                {
+                    frame[i] = m_ring[(m_tail + i) & (RING_SIZE - 1)];
+                }
+                P::Decode(frame, time, report);
+                if (m_pFlight)
+                {
+                    uint32_t raw = 0;
+                    for (unsigned i = 0; i < (unsigned)P::SIZE; i++)
+                    {
+                        raw |= (uint32_t)frame[i] << (i * 8);
+                    }
+                    m_pFlight->Record(FlightRecorder::FLIGHT_PS2, time, 0, P::SIZE, (int32_t)raw);
+                }
+                if (m_pCounters)
+                {
+                    m_pCounters->Add(RuntimeCounters::PACKETS);
+                    if (frame[0] & 0xc0)
+                    {
+                        m_pCounters->Add(RuntimeCounters::OVERFLOWS);
+                    }
+                }
+                m_tail += P::SIZE;
+                return true;
+            }
+            return false;
+        }
+
+    private:
+        void Count(ssize_t nLen)
+        {
+            if (nLen > 0)
+            {
+                m_pCounters->Add(RuntimeCounters::READS);
+                if (nLen % P::SIZE)
+                {
+                    // ACK bytes or a packet cut by the ring
+                    m_pCounters->Add(RuntimeCounters::SHORT_READS);
+                }
+            }
+            else if (nLen == -1 && errno == EAGAIN)
+            {
+                m_pCounters->Add(RuntimeCounters::READ_EAGAIN);
+            }
+        }
+
+    private:
+        int m_fd;
+        BYTE m_ring[RING_SIZE];
+        // free running write/read position
+        unsigned m_head;
+        unsigned m_tail;
+        FlightRecorder *m_pFlight;
+        RuntimeCounters *m_pCounters;
+};
+
+// which protocol the mouse speaks: the IntelliMouse sample rate sequence
+// 200/100/80 then Get Device ID, and the Explorer sequence 200/200/80 on
+// top of it, like psmouse does. every byte waits for its ACK. a mouse
+// that does not answer as expected is reset to plain PS/2 instead of
+// guessing a packet size
+class Ps2Probe
+{
+    public:
+        enum {
+            PS2_ACK = 0xfa,
+            CMD_SET_RATE = 0xf3,
+            CMD_GET_ID = 0xf2,
+            CMD_RESET = 0xff,
+            REPLY_MS = 100
+        };
+
+    public:
+        // Ps2Protocol::ID, Imps2Protocol::ID or ExplorerProtocol::ID
+        static int Probe(int fd)
+        {
+            static const BYTE imps_seq[] = { CMD_SET_RATE, 200, CMD_SET_RATE, 100, CMD_SET_RATE, 80 };
+            static const BYTE exps_seq[] = { CMD_SET_RATE, 200, CMD_SET_RATE, 200, CMD_SET_RATE, 80 };
+
+            Drain(fd);
+            int id = Identify(fd, imps_seq, sizeof(imps_seq));
+            if (id == Ps2Protocol::ID)
+            {
+                return Ps2Protocol::ID;
+            }
+            if (id == Imps2Protocol::ID)
+            {
+                id = Identify(fd, exps_seq, sizeof(exps_seq));
+                if (id == ExplorerProtocol::ID || id == Imps2Protocol::ID)
+                {
+                    return id;
+                }
+            }
+
+            // no answer or a strange one, back to the power on protocol
+            Command(fd, CMD_RESET);
+            Drain(fd);
+            return Ps2Protocol::ID;
+        }
+
+    private:
+        // sample rate sequence then Get Device ID, -1 on no answer
+        static int Identify(int fd, const BYTE *seq, unsigned nLen)
+        {
+            for (unsigned i = 0; i < nLen; i++)
+            {
+                if (!Command(fd, seq[i]))
+                {
+                    return -1;
+                }
+            }
+            if (!Command(fd, CMD_GET_ID))
+            {
+                return -1;
+            }
+            return Read(fd);
+        }
+
+        // one byte and its ACK, motion bytes in between are dropped
+        static bool Command(int fd, BYTE c)
+        {
+            if (write(fd, &c, 1) != 1)
+            {
+                return false;
+            }
+            int b;
+            while ((b = Read(fd)) != -1)
+            {
+                if (b == PS2_ACK)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // one byte within REPLY_MS, -1 on timeout or error
+        static int Read(int fd)
+        {
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            while (true)
+            {
+                int ret = poll(&pfd, 1, REPLY_MS);
+                if (ret == -1 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (ret <= 0)
+                {
+                    return -1;
+                }
+                BYTE b;
+                ssize_t nLen = read(fd, &b, 1);
+                if (nLen == 1)
+                {
+                    return b;
+                }
+                if (nLen == 0 || (errno != EAGAIN && errno != EINTR))
+                {
+                    return -1;
+                }
+            }
+        }
+
+        // whatever is queued, a reset answers AA 00 which looks like a frame.
+        // bounded, a moving mouse never runs dry
+        static void Drain(int fd)
+        {
+            BYTE buf[64];
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            for (int i = 0; i < 8 && poll(&pfd, 1, 10) > 0; i++)
+            {
+                if (read(fd, buf, sizeof(buf)) <= 0)
+                {
+                    return;
+                }
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,191 @@
+// @brief: where the time between a click and its character goes, in
+//         log-linear histograms cheap enough to stay on in production
+//
+//    read    kernel event time to our read (evdev with monotonic stamps)
+//    emit    read of the batch (or timer expiry) to the action queued
+//    write   one writev() of the output queue
+//    timer   how late the timer fired after the deadline
+//
+// a histogram is a fixed array of counters: values below 2^SUB_BITS us
+// have a bucket each, every power of two above is cut in 2^SUB_BITS
+// linear buckets, 12.5% wide at SUB_BITS 3. a sample is a CLZ, a shift
+// and an increment, no allocation and no division. percentiles and max
+// are served by the stats socket (stats_socket.h) and on SIGUSR1
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+
+class LogLinearHistogram
+{
+    public:
+        enum {
+            SUB_BITS = 3,
+            SUB_BUCKETS = 1 << SUB_BITS,
+            // 32 bit values, one group per power of two above the linear ones
+            BUCKETS = (32 - SUB_BITS + 1) * SUB_BUCKETS
+        };
+
+    public:
+        LogLinearHistogram()
+        {
+            Clear();
+        }
+
+        void Clear()
+        {
+            memset(m_count, 0, sizeof(m_count));
+            m_nTotal = 0;
+            m_nSum = 0;
+            m_nMax = 0;
+        }
+
+        // one sample in us, negative (clock skew) counts as 0
+        void Record(tick_t value)
+        {
+            uint32_t v = value <= 0 ? 0 : value >= (tick_t)UINT32_MAX ? UINT32_MAX : (uint32_t)value;
+            m_count[Bucket(v)]++;
+            m_nTotal++;
+            m_nSum += v;
+            if (v > m_nMax)
+            {
+                m_nMax = v;
+            }
+        }
+
+        uint32_t Total()
+        {
+            return m_nTotal;
+        }
+
+        uint64_t Sum()
+        {
+            return m_nSum;
+        }
+
+        uint32_t Max()
+        {
+            return m_nMax;
+        }
+
+        // upper bound of the bucket holding the permille-th sample
+        uint32_t Percentile(unsigned permille)
+        {
+            if (m_nTotal == 0)
+            {
+                return 0;
+            }
+            uint64_t rank = ((uint64_t)m_nTotal * permille + 999) / 1000;
+            uint64_t n = 0;
+            for (int i = 0; i < BUCKETS; i++)
+            {
+                n += m_count[i];
+                if (n >= rank && n > 0)
+                {
+                    uint32_t high = Lower(i + 1) - 1;
+                    return high < m_nMax ? high : m_nMax;
+                }
+            }
+            return m_nMax;
+        }
+
+        static int Bucket(uint32_t v)
+        {
+            if (v < (uint32_t)SUB_BUCKETS)
+            {
+                return v;
+            }
+            // v has e + 1 bits, the SUB_BITS below the top one pick the bucket
+            int e = 31 - __builtin_clz(v);
+            return (e - SUB_BITS + 1) * SUB_BUCKETS + ((v >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+        }
+
+        // smallest value of bucket i
+        static uint32_t Lower(int i)
+        {
+            if (i < SUB_BUCKETS)
+            {
+                return i;
+            }
+            if (i >= BUCKETS)
+            {
+                return UINT32_MAX;
+            }
+            int e = i / SUB_BUCKETS + SUB_BITS - 1;
+            return (uint32_t)(SUB_BUCKETS + i % SUB_BUCKETS) << (e - SUB_BITS);
+        }
+
+    private:
+        uint32_t m_count[BUCKETS];
+        uint32_t m_nTotal;
+        uint64_t m_nSum;
+        uint32_t m_nMax;
+};
+
+class LatencyStats
+{
+    public:
+        enum {
+            HIST_READ,
+            HIST_EMIT,
+            HIST_WRITE,
+            HIST_TIMER,
+            HISTS
+        };
+
+    public:
+        LatencyStats()
+        :m_tick_batch(0)
+        {
+        }
+
+        // input was read or a timer expired at now, the actions that
+        // follow are timed from here
+        void Batch(tick_t now)
+        {
+            m_tick_batch = now;
+        }
+
+        // an event stamped time by the kernel was read at the last Batch()
+        void Read(tick_t time)
+        {
+            m_hist[HIST_READ].Record(m_tick_batch - time);
+        }
+
+        void Emitted(tick_t now)
+        {
+            m_hist[HIST_EMIT].Record(now - m_tick_batch);
+        }
+
+        void Write(tick_t start, tick_t end)
+        {
+            m_hist[HIST_WRITE].Record(end - start);
+        }
+
+        // the timer of deadline was served at now
+        void Timer(tick_t deadline, tick_t now)
+        {
+            m_hist[HIST_TIMER].Record(now - deadline);
+        }
+
+        LogLinearHistogram &Hist(int i)
+        {
+            return m_hist[i];
+        }
+
+        static const char *Name(int i)
+        {
+            static const char *names[HISTS] = { "read", "emit", "write", "timer" };
+            return names[i];
+        }
+
+    private:
+        tick_t m_tick_batch;
+        LogLinearHistogram m_hist[HISTS];
+};
+
+#endif
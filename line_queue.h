@@ -0,0 +1,249 @@
+// @brief: bounded queue of pre-encoded text action lines
+//
+// one writev()/sendmsg() writes the whole queue, a partial write keeps
+// the rest. wheel steps can be coalesced when the queue is full, the
+// caller says which actions are wheel steps and in which direction:
+// wheel 0 is a button action, lines of the same wheel value merge and
+// -wheel is the opposite direction. the code does not tell, it can be
+// rebound.
+// a line is "<code>\n", or "<code> <dev>\n" with device tags. an action
+// that stands for count > 1 wheel detents is "<code>*<count>"
+
+#ifndef LINE_QUEUE_H
+#define LINE_QUEUE_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+class LineQueue
+{
+    public:
+        enum {
+            QUEUE_SIZE = 64,    // power of two
+            LINE_SIZE = 16,
+            MAX_COUNT = 9999    // "9*9999 65535\n" fits a line
+        };
+
+    public:
+        LineQueue()
+        :m_head(0),
+        m_tail(0),
+        m_nOffset(0),
+        m_bTag(false)
+        {
+        }
+
+        // tag each line with its source device
+        void SetTag(bool bTag)
+        {
+            m_bTag = bTag;
+        }
+
+        bool Empty()
+        {
+            return m_head == m_tail;
+        }
+
+        bool Full()
+        {
+            return m_head - m_tail == QUEUE_SIZE;
+        }
+
+        void Clear()
+        {
+            m_head = 0;
+            m_tail = 0;
+            m_nOffset = 0;
+        }
+
+        // queue one action line, the queue must not be full
+        void Push(char code, int dev, int count = 1, int wheel = 0)
+        {
+            Encode(m_queue[m_head & (QUEUE_SIZE - 1)], code, dev, count, wheel);
+            m_head++;
+        }
+
+        // queue is full. wheel actions are coalesced: a new one is merged
+        // into the newest queued one of the same direction, re-encoded as
+        // "<code>*<count>", or cancels against a queued opposite one right
+        // before it. for a button action two queued wheel lines of the same
+        // direction are merged to make room. no step is lost either way.
+        // return true if the action is taken care of, false if it still
+        // finds no room
+        bool Coalesce(char code, int dev, int count = 1, int wheel = 0)
+        {
+            // first entry may be partially written, keep it
+            unsigned first = m_tail + (m_nOffset ? 1 : 0);
+
+            if (wheel != 0)
+            {
+                if (m_head != first)
+                {
+                    line &l = m_queue[(m_head - 1) & (QUEUE_SIZE - 1)];
+                    if (l.wheel == -wheel && l.dev == dev)
+                    {
+                        // opposite steps cancel, the larger one keeps the rest
+                        int net = l.count - count;
+                        if (net > 0)
+                        {
+                            Encode(l, l.code, dev, net, l.wheel);
+                        }
+                        else if (net < 0)
+                        {
+                            Encode(l, code, dev, -net, wheel);
+                        }
+                        else
+                        {
+                            m_head--;
+                        }
+                        return true;
+                    }
+                }
+                for (unsigned i = m_head; i != first; i--)
+                {
+                    line &l = m_queue[(i - 1) & (QUEUE_SIZE - 1)];
+                    if (l.wheel == wheel && l.code == code && l.dev == dev && l.count + count <= MAX_COUNT)
+                    {
+                        Encode(l, code, dev, l.count + count, wheel);
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // the newest wheel line that has an older one to merge into
+            for (unsigned i = m_head; i != first; i--)
+            {
+                line &l = m_queue[(i - 1) & (QUEUE_SIZE - 1)];
+                if (l.wheel == 0)
+                {
+                    continue;
+                }
+                for (unsigned k = i - 1; k != first; k--)
+                {
+                    line &o = m_queue[(k - 1) & (QUEUE_SIZE - 1)];
+                    if (o.wheel == l.wheel && o.code == l.code && o.dev == l.dev &&
+                        o.count + l.count <= MAX_COUNT)
+                    {
+                        Encode(o, o.code, o.dev, o.count + l.count, o.wheel);
+                        for (unsigned j = i; j != m_head; j++)
+                        {
+                            m_queue[(j - 1) & (QUEUE_SIZE - 1)] = m_queue[j & (QUEUE_SIZE - 1)];
+                        }
+                        m_head--;
+                        Push(code, dev, count, wheel);
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        // one writev() of the whole queue, sendmsg() without SIGPIPE for
+        // sockets. return bytes written or -1 (see errno)
+        ssize_t Write(int fd, bool bSocket)
+        {
+            struct iovec iov[QUEUE_SIZE];
+            unsigned nCount = 0;
+            for (unsigned i = m_tail; i != m_head; i++)
+            {
+                line &l = m_queue[i & (QUEUE_SIZE - 1)];
+                iov[nCount].iov_base = l.text;
+                iov[nCount].iov_len = l.len;
+                nCount++;
+            }
+            if (nCount == 0)
+            {
+                return 0;
+            }
+            iov[0].iov_base = (char *)iov[0].iov_base + m_nOffset;
+            iov[0].iov_len -= m_nOffset;
+
+            ssize_t nLen;
+            if (bSocket)
+            {
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = nCount;
+                nLen = sendmsg(fd, &msg, MSG_NOSIGNAL|MSG_DONTWAIT);
+            }
+            else
+            {
+                nLen = writev(fd, iov, nCount);
+            }
+
+            if (nLen > 0)
+            {
+                Consume(nLen);
+            }
+            return nLen;
+        }
+
+    private:
+        struct line
+        {
+            char text[LINE_SIZE];
+            unsigned char len;
+            char code;
+            int dev;
+            int count;
+            int wheel;
+        };
+
+        void Encode(line &l, char code, int dev, int count, int wheel)
+        {
+            l.code = code;
+            l.dev = dev;
+            l.count = count;
+            l.wheel = wheel;
+            if (count > 1)
+            {
+                l.len = m_bTag ? snprintf(l.text, LINE_SIZE, "%c*%d %d\n", code, count, dev) :
+                    snprintf(l.text, LINE_SIZE, "%c*%d\n", code, count);
+            }
+            else if (m_bTag)
+            {
+                l.len = snprintf(l.text, LINE_SIZE, "%c %d\n", code, dev);
+            }
+            else
+            {
+                l.text[0] = code;
+                l.text[1] = '\n';
+                l.len = 2;
+            }
+        }
+
+        void Consume(size_t nLen)
+        {
+            while (nLen > 0)
+            {
+                line &l = m_queue[m_tail & (QUEUE_SIZE - 1)];
+                size_t nLeft = l.len - m_nOffset;
+                if (nLen < nLeft)
+                {
+                    m_nOffset += nLen;
+                    return;
+                }
+                nLen -= nLeft;
+                m_nOffset = 0;
+                m_tail++;
+            }
+        }
+
+    private:
+        line m_queue[QUEUE_SIZE];
+        // free running write/read position
+        unsigned m_head;
+        unsigned m_tail;
+        // bytes of the tail line already written
+        unsigned m_nOffset;
+
+        bool m_bTag;
+};
+
+#endif
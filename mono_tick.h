@@ -0,0 +1,46 @@
+// @brief: monotonic time as integer ticks of 1 us
+//
+// conversions from kernel time are multiply/add only, the 64 bit division
+// (no hardware divide on ARM9) is kept off the per event path
+
+#ifndef MONO_TICK_H
+#define MONO_TICK_H
+
+#include <sys/time.h>
+#include <time.h>
+#include <stdint.h>
+
+// CLOCK_MONOTONIC in microseconds
+typedef int64_t tick_t;
+
+enum {
+    TICKS_PER_MS = 1000,
+    TICKS_PER_SEC = 1000000
+};
+
+inline tick_t TimevalToTick(const struct timeval &tv)
+{
+    return (tick_t)tv.tv_sec * TICKS_PER_SEC + tv.tv_usec;
+}
+
+inline tick_t TimespecToTick(const struct timespec &ts)
+{
+    // 32 bit divide by constant, compiled to a multiply
+    return (tick_t)ts.tv_sec * TICKS_PER_SEC + (uint32_t)ts.tv_nsec / 1000u;
+}
+
+// only for arming timers, once per click
+inline void TickToTimespec(tick_t tick, struct timespec &ts)
+{
+    ts.tv_sec = (time_t)(tick / TICKS_PER_SEC);
+    ts.tv_nsec = (long)(tick - (tick_t)ts.tv_sec * TICKS_PER_SEC) * 1000;
+}
+
+inline tick_t NowTick()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return TimespecToTick(ts);
+}
+
+#endif
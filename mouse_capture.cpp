@@ -1,5 +1,5 @@
 // @author: lbzhung
-// @brief: capture mouse data by /dev/input/mice 
+// @brief: capture mouse data by /dev/input/mice or evdev nodes (-e, -a)
 // @see: linux kernel drivers/input/mousedev.c
 //       http://www.computer-engineering.org/ps2mouse/
 //       
@@ -12,269 +12,947 @@
 //    9  rolling down
 //    0  rolling up
 //    q  click left button and click right button immediately, program will exit
+//    Z  the left click sent at once becomes a double click left (-S l)
+//    X  the right click sent at once becomes a double click right (-S r)
+//    9*N, 0*N  N wheel detents summed in one action (-w)
+//    [  ]  horizontal wheel left, right
+//    j  k  h  l  fine step of a high resolution wheel down, up, left,
+//       right (-f), "j*N" for N steps in one report
+//    these are the default bindings, -c file remaps them (gesture_table.h)
 
 #include <cstdio>
+#include <cstdlib>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <time.h>
 #include <fcntl.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <assert.h>
+#include <stdint.h>
+#include <new>
 
-typedef unsigned char BYTE;
+#include "mono_tick.h"
+#include "imps2_reader.h"
+#include "mouse_report.h"
+#include "evdev_reader.h"
+#include "output.h"
+#include "button_process.h"
+#include "device_manager.h"
+#include "capture_log.h"
+#include "capture_replay.h"
+#include "latency_stats.h"
+#include "stats_socket.h"
+#include "runtime_counters.h"
+#include "trace_writer.h"
+#include "realtime.h"
+#include "flight_recorder.h"
 
-#pragma pack(1)
-struct imps2_data
+// flight recorder dump, --flight changes it
+#define FLIGHT_PATH "/tmp/mouse_capture.flight"
+// --stats-file rewrite period
+#define STATS_FILE_SEC 10
+
+static void Usage(const char *name)
 {
-    BYTE btn_left:1;
-    BYTE btn_right:1;
-    BYTE btn_middle:1;
-    BYTE NONE:1;
-    BYTE x_sign:1;  // x offset sign
-    BYTE y_sign:1;  // y offset sign
-    BYTE x_overflow:1; // x offset is overflow
-    BYTE y_overflow:1; // y offset is overflow
-
-    // x/y movement offset relative to its position
-    signed char x;
-    signed char y;
-    signed char z;
-};
-#pragma pack()
-
-// button double click process
-class ButtonProcess
+    fprintf(stderr,
+            "usage: %s [-e /dev/input/eventN | -a] [-g] [-t] [-S lr] [-m dist]\n"
+            "          [-A min-max [-H file]] [-c file] [-w ms[,accel]] [-f units]\n"
+            "          [-s /name] [-u path [-p policy]]\n"
+            "          [--record file | --replay file [--fast]] [--stats path]\n"
+            "          [--stats-file file] [--flight file] [--trace file]\n"
+            "          [--realtime[=prio[,cpu]]]\n"
+            "  -e dev  read evdev node instead of /dev/input/mice\n"
+            "  -a      read every evdev mouse in /dev/input, follow hotplug\n"
+            "  -g      grab the evdev nodes, no other consumer gets their events\n"
+            "  -t      tag text actions with the source device, \"<action> <N>\"\n"
+            "          with N of /dev/input/eventN\n"
+            "  -S btns send single clicks of these buttons (l, r, m) at once and\n"
+            "          the upgrade action (Z/X) when they turn out to be a double click\n"
+            "  -m dist send a pending click as single click once the mouse moved\n"
+            "          dist units, or on wheel and other buttons\n"
+            "  -A min-max  learn the double click window from the click intervals,\n"
+            "          within min and max ms\n"
+            "  -H file keep the learned click intervals in file across restarts\n"
+            "  -c file remap the actions with a gesture binding file (gesture_table.h)\n"
+            "  -w ms[,accel]  sum wheel detents over ms and send them as one\n"
+            "          \"9*N\" action, every detent in one window adds accel %%\n"
+            "          to the count\n"
+            "  -f units  fine wheel actions (j k h l) every units of a high\n"
+            "          resolution wheel, 120 units are one detent\n"
+            "  -s name binary action records to shared memory ring (shm_ring.h)\n"
+            "  -u path text actions to every subscriber of a unix socket\n"
+            "  -p pol  slow subscriber policy: drop, coalesce (default), disconnect\n"
+            "  --record file  append the raw input to file (capture_log.h)\n"
+            "  --replay file  play a recorded file instead of reading a mouse,\n"
+            "          at the recorded speed, or as fast as it can with --fast\n"
+            "  --stats path  counters and latency histograms in Prometheus text\n"
+            "          to every client of a unix socket, SIGUSR1 writes them to stderr\n"
+            "  --stats-file file  the same written to file every %d s, put it on\n"
+            "          tmpfs\n"
+            "  --flight file  where the recent packets, transitions and actions go\n"
+            "          on SIGUSR2, q, a fatal error or a crash (flight_recorder.h),\n"
+            "          default " FLIGHT_PATH "\n"
+            "  --trace file  timeline of wakeups, reads, reports, transitions,\n"
+            "          timers and writes in Chrome trace JSON (trace_writer.h)\n"
+            "  --realtime[=prio[,cpu]]  SCHED_FIFO at prio (default %d), memory\n"
+            "          locked and prefaulted, pinned to cpu if given (realtime.h)\n"
+            "  text goes to stdout if neither -s nor -u is given\n"
+#ifdef STATIC_GESTURES
+            "  gestures are compiled in (gesture_spec.h), no -S, -m or -c\n"
+#endif
+            ,
+            name, STATS_FILE_SEC, (int)Realtime::DEFAULT_PRIORITY);
+}
+
+// one read of mousedev packets in protocol P, DEVICE_QUIT on q,
+// DEVICE_GONE on end of file or read error
+template <class P>
+static int MiceInput(Ps2Reader<P> &reader, ButtonProcess &btnProcess, CaptureLog &log, LatencyStats &stats,
+        TraceWriter &trace)
 {
-    public:
-        enum {
-            BTN_LEFT,
-            BTN_RIGHT,
-            BTN_NULL
-        };
-
-    public:
-        ButtonProcess()
-        :m_btnPre(BTN_NULL),
-        m_bTimer(false)
-        {
-            m_tv_cur.tv_sec = 0;
-            m_tv_cur.tv_usec = 0;
-        }
+    tick_t start = trace.IsOpen() ? NowTick() : 0;
+    int nLen = reader.Fill();
+    if (nLen == 0 || (nLen == -1 && errno != EAGAIN))
+    {
+        return DEVICE_GONE;
+    }
 
-        void EnableTimer()
-        {
-            m_bTimer = true;
-            gettimeofday(&m_tv_cur, NULL);
-        }
+    // mousedev has no timestamps, take the read time
+    tick_t now = NowTick();
+    stats.Batch(now);
+    if (nLen > 0)
+    {
+        trace.Slice(TraceWriter::TRACE_READ, 1, start, now, nLen);
+    }
+    if (nLen > 0 && log.IsOpen())
+    {
+        reader.Log(log, nLen, now);
+    }
 
-        void DisableTimer()
+    // ack bytes and partial frames are handled by reader
+    mouse_report report;
+    while (reader.Next(report, now))
+    {
+        if (!btnProcess.Report(report))
         {
-            m_bTimer = false;
+            return DEVICE_QUIT;
         }
+    }
+    return DEVICE_OK;
+}
+
+// SIGUSR1, the stats are written by the loop, not the handler
+static volatile sig_atomic_t s_bDumpStats = 0;
+
+static void DumpStats(int)
+{
+    s_bDumpStats = 1;
+}
+
+// always on, global for the crash handler
+static FlightRecorder s_flight;
+static const char *s_flight_path = FLIGHT_PATH;
+static volatile sig_atomic_t s_bDumpFlight = 0;
+
+static void DumpFlight(int)
+{
+    s_bDumpFlight = 1;
+}
+
+// --trace, closed on every way out but a crash
+static TraceWriter s_trace;
+
+// the loop should not allocate, what it does is counted once it runs.
+// every form of new and delete is replaced, so none of them bypasses the
+// count or frees what another heap allocated
+static RuntimeCounters *s_pAllocs = NULL;
+
+// the exception specifications of <new> differ between C++98 and C++11
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#define NO_THROW noexcept
+#else
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define NO_THROW throw()
+#endif
+
+static void *Allocate(size_t nSize)
+{
+    if (s_pAllocs)
+    {
+        s_pAllocs->Add(RuntimeCounters::ALLOCS);
+    }
+    return malloc(nSize ? nSize : 1);
+}
+
+// out of line, gcc takes an inlined free() for a mismatch with new
+static void __attribute__((noinline)) Release(void *p)
+{
+    free(p);
+}
+
+void *operator new(size_t nSize) THROWS_BAD_ALLOC
+{
+    void *p = Allocate(nSize);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t nSize) THROWS_BAD_ALLOC
+{
+    return operator new(nSize);
+}
+
+void *operator new(size_t nSize, const std::nothrow_t &) NO_THROW
+{
+    return Allocate(nSize);
+}
+
+void *operator new[](size_t nSize, const std::nothrow_t &) NO_THROW
+{
+    return Allocate(nSize);
+}
+
+void operator delete(void *p) NO_THROW
+{
+    Release(p);
+}
+
+void operator delete[](void *p) NO_THROW
+{
+    Release(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) NO_THROW
+{
+    Release(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) NO_THROW
+{
+    Release(p);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void *p, size_t) NO_THROW
+{
+    Release(p);
+}
+
+void operator delete[](void *p, size_t) NO_THROW
+{
+    Release(p);
+}
+#endif
+
+// SIGSEGV and friends, the ring is written with write() only and the
+// default action follows (SA_RESETHAND)
+static void Crash(int sig)
+{
+    s_flight.Record(FlightRecorder::FLIGHT_SIGNAL, NowTick(), 0, sig);
+    s_flight.DumpTo(s_flight_path);
+    raise(sig);
+}
+
+// the loop gives up, keep what led there
+static int Fatal()
+{
+    s_flight.Record(FlightRecorder::FLIGHT_FATAL, NowTick(), 0, 0);
+    s_flight.DumpTo(s_flight_path);
+    s_trace.Close();
+    return 1;
+}
+
+// a capture log on the virtual clock, paced to the recorded time unless
+// bFast. socket subscribers and stdout are served while it waits
+static int Replay(CaptureReplay &replay, bool bFast, int epoll_fd, Output &output, SocketServer &server)
+{
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (timer_fd == -1)
+    {
+        return 1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+    {
+        return 1;
+    }
 
-        bool IsTimerEnable()
+    // virtual time + offset is the wall time to play at
+    bool bFirst = true;
+    tick_t offset = 0;
+    tick_t time;
+    while (replay.Due(time))
+    {
+        if (bFirst)
         {
-            return m_bTimer;
+            offset = NowTick() - time;
+            bFirst = false;
         }
 
-        bool Button(int type)
+        if (!bFast && time + offset > NowTick())
         {
-            assert(type == BTN_LEFT || type == BTN_RIGHT);
-            if (m_btnPre == BTN_NULL)
-            {
-                // save btn wait timeout and send
-                m_btnPre = type;
-                EnableTimer();
-            }
-            else if (m_btnPre != type)
-            {
-                // left and right, quit
-                printf("q\n");
-                fflush(stdout);
-                m_btnPre = BTN_NULL;
-                DisableTimer();
-                return false;
-            }
-            else
+            struct itimerspec its;
+            its.it_interval.tv_sec = 0;
+            its.it_interval.tv_nsec = 0;
+            TickToTimespec(time + offset, its.it_value);
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+            bool bDue = false;
+            while (!bDue)
             {
-                if (m_btnPre == BTN_LEFT)
+                struct epoll_event events[8];
+                int ret = epoll_wait(epoll_fd, events, 8, -1);
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return 1;
+                }
+                for (int i = 0; i < ret; i++)
                 {
-                    // double click left
-                    printf("z\n");
-                    fflush(stdout);
+                    int fd = events[i].data.fd;
+                    if (fd == timer_fd)
+                    {
+                        uint64_t expirations;
+                        bDue = read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+                    }
+                    else if (server.Owns(fd))
+                    {
+                        server.Event(fd, events[i].events);
+                    }
+                    else if (events[i].events & (EPOLLERR|EPOLLHUP))
+                    {
+                        // stdout, consumer is gone
+                        return 1;
+                    }
                 }
-                else
+                if (!output.Flush())
                 {
-                    // double click right
-                    printf("x\n");
-                    fflush(stdout);
+                    return 1;
                 }
-                m_btnPre = BTN_NULL;
-                DisableTimer();
             }
-            return true;
         }
 
-        void Timer()
+        if (replay.Step() == DEVICE_QUIT)
         {
-            if (IsTimerEnable())
-            {
-                //printf("in Timer\n");
-                //
-                // timeout 300ms
-                struct timeval tv;
-                gettimeofday(&tv, NULL);
-                long tv_interval_ms = (tv.tv_sec*1000 + tv.tv_usec/1000) - (m_tv_cur.tv_sec*1000 + m_tv_cur.tv_usec/1000);
-                if (tv_interval_ms >= 300)
-                {
-                    assert(m_btnPre != BTN_NULL);
-                    DisableTimer();
+            // OK quit
+            break;
+        }
+        if (!output.Flush())
+        {
+            //fprintf(stderr, "write stdout fail\n");
+            return 1;
+        }
+    }
+    output.Drain();
+    return 0;
+}
 
-                    if (m_btnPre == BTN_LEFT)
+int main(int argc, char *argv[])
+{
+    const char *evdev_path = NULL;
+    bool bAll = false;
+    bool bGrab = false;
+    bool bTag = false;
+    const char *shm_name = NULL;
+    const char *socket_path = NULL;
+    int nPolicy = SocketServer::POLICY_COALESCE;
+    button_config config;
+    int nWindowMin = 0;
+    int nWindowMax = 0;
+    int nWheelMs = 0;
+    int nWheelAccel = 0;
+    const char *hist_path = NULL;
+    const char *gesture_path = NULL;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    bool bFast = false;
+    const char *stats_path = NULL;
+    const char *stats_file = NULL;
+    const char *trace_path = NULL;
+    bool bRealtime = false;
+    int nPriority = Realtime::DEFAULT_PRIORITY;
+    int nCpu = -1;
+
+    // long options only, their values are past the single letters
+    enum { OPT_RECORD = 256, OPT_REPLAY, OPT_FAST, OPT_STATS, OPT_STATS_FILE, OPT_FLIGHT, OPT_TRACE,
+        OPT_REALTIME };
+    static const struct option long_options[] = {
+        { "record", required_argument, NULL, OPT_RECORD },
+        { "replay", required_argument, NULL, OPT_REPLAY },
+        { "fast", no_argument, NULL, OPT_FAST },
+        { "stats", required_argument, NULL, OPT_STATS },
+        { "stats-file", required_argument, NULL, OPT_STATS_FILE },
+        { "flight", required_argument, NULL, OPT_FLIGHT },
+        { "trace", required_argument, NULL, OPT_TRACE },
+        { "realtime", optional_argument, NULL, OPT_REALTIME },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "e:agtS:m:A:H:c:w:f:s:u:p:", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case OPT_RECORD:
+                record_path = optarg;
+                break;
+            case OPT_REPLAY:
+                replay_path = optarg;
+                break;
+            case OPT_FAST:
+                bFast = true;
+                break;
+            case OPT_STATS:
+                stats_path = optarg;
+                break;
+            case OPT_STATS_FILE:
+                stats_file = optarg;
+                break;
+            case OPT_FLIGHT:
+                s_flight_path = optarg;
+                break;
+            case OPT_TRACE:
+                trace_path = optarg;
+                break;
+            case OPT_REALTIME:
+                if (!Realtime::Parse(optarg, nPriority, nCpu))
+                {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                bRealtime = true;
+                break;
+            case 'm':
+                config.motion_resolve = atoi(optarg);
+                break;
+            case 'A':
+                if (sscanf(optarg, "%d-%d", &nWindowMin, &nWindowMax) != 2 ||
+                    nWindowMin <= 0 || nWindowMin > nWindowMax)
+                {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'H':
+                hist_path = optarg;
+                break;
+            case 'S':
+                for (const char *p = optarg; *p; p++)
+                {
+                    if (*p == 'l')
                     {
-                        // left
-                        printf("<\n");
-                        fflush(stdout);
+                        config.speculative[GestureTable::BUTTON_LEFT] = true;
+                    }
+                    else if (*p == 'r')
+                    {
+                        config.speculative[GestureTable::BUTTON_RIGHT] = true;
+                    }
+                    else if (*p == 'm')
+                    {
+                        config.speculative[GestureTable::BUTTON_MIDDLE] = true;
                     }
                     else
                     {
-                        // right
-                        printf(">\n");
-                        fflush(stdout);
+                        Usage(argv[0]);
+                        return 1;
                     }
-                    // reset m_btnPre
-                    m_btnPre = BTN_NULL;
                 }
-            }
+                break;
+            case 'c':
+                gesture_path = optarg;
+                break;
+            case 'w':
+                if (sscanf(optarg, "%d,%d", &nWheelMs, &nWheelAccel) < 1 ||
+                    nWheelMs <= 0 || nWheelAccel < 0)
+                {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                config.wheel_fine = atoi(optarg);
+                if (config.wheel_fine <= 0)
+                {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'u':
+                socket_path = optarg;
+                break;
+            case 'p':
+                nPolicy = SocketServer::ParsePolicy(optarg);
+                if (nPolicy == -1)
+                {
+                    Usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 's':
+                shm_name = optarg;
+                break;
+            case 'e':
+                evdev_path = optarg;
+                break;
+            case 'a':
+                bAll = true;
+                break;
+            case 'g':
+                bGrab = true;
+                break;
+            case 't':
+                bTag = true;
+                break;
+            default:
+                Usage(argv[0]);
+                return 1;
         }
+    }
 
-    private:
-        int m_btnPre;
-        // time for double click check
-        struct timeval m_tv_cur;
-        bool m_bTimer;
-};
+    if ((record_path && replay_path) || (bFast && !replay_path) ||
+        (replay_path && (evdev_path || bAll || bGrab)))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
 
-int main(int argc, char *argv[])
-{
-    BYTE mousedev_imps_seq[] = { 0xf3, 200, 0xf3, 100, 0xf3, 80 };
-    int mice_fd = open("/dev/input/mice", O_RDWR|O_NONBLOCK);
-    if (mice_fd == -1)
+#ifdef STATIC_GESTURES
+    // bindings, -S and -m are fixed at compile time (gesture_spec.h)
+    bool bFixed = gesture_path || config.motion_resolve;
+    for (int b = 0; b < GestureTable::BUTTONS; b++)
+    {
+        bFixed = bFixed || config.speculative[b];
+    }
+    if (bFixed)
     {
-        //fprintf(stderr, "Open mice fail");
+        Usage(argv[0]);
         return 1;
     }
+    gesture_table_t gestures;
+    config.motion_resolve = gesture_table_t::MOTION_RESOLVE;
+#else
+    // bindings, compiled once for every device
+    GestureTable gestures;
+    if (gesture_path)
+    {
+        if (!gestures.Load(gesture_path))
+        {
+            //fprintf(stderr, "bad gesture config\n");
+            return 1;
+        }
+    }
+    else
+    {
+        gestures.Default();
+    }
+    gestures.Compile(config.speculative, config.motion_resolve > 0);
+#endif
+    config.pGestures = &gestures;
+
+    // accel percent to Q8 gain
+    config.wheel_window = (tick_t)nWheelMs * TICKS_PER_MS;
+    config.wheel_accel = nWheelAccel * (1 << WheelAggregator::GAIN_SHIFT) / 100;
+
+    AdaptiveWindow adaptive((tick_t)nWindowMin * TICKS_PER_MS, (tick_t)nWindowMax * TICKS_PER_MS,
+            ButtonProcess::DBLCLICK_TICKS, hist_path);
+    if (nWindowMax > 0)
+    {
+        if (hist_path)
+        {
+            // first run has no file yet
+            adaptive.Load();
+        }
+        config.pAdaptive = &adaptive;
+    }
 
-    // set mice mode, so can read rolling wheels
-    int nRet = write(mice_fd, mousedev_imps_seq, sizeof(mousedev_imps_seq));
-    if (nRet < 0)
+    int epoll_fd = epoll_create(8);
+    if (epoll_fd == -1)
     {
-        //fprintf(stderr, "set mice imps2 fail\n");
+        //fprintf(stderr, "create epoll fail\n");
         return 1;
     }
 
-    ButtonProcess btnProcess;
-    while (true)
+    Output output(STDOUT_FILENO);
+    output.SetTag(bTag);
+    ShmRing shm;
+    if (shm_name)
+    {
+        if (!shm.Open(shm_name))
+        {
+            //fprintf(stderr, "open shm ring fail\n");
+            return 1;
+        }
+        output.SetShm(&shm);
+    }
+
+    SocketServer server;
+    if (socket_path)
+    {
+        server.SetTag(bTag);
+        if (!server.Listen(socket_path, epoll_fd, nPolicy))
+        {
+            //fprintf(stderr, "listen on socket fail\n");
+            return 1;
+        }
+        output.SetServer(&server);
+    }
+
+    if (!shm_name && !socket_path && !output.Setup(epoll_fd))
     {
-        fd_set fdset;
-        // 20 ms
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 20000;
+        //fprintf(stderr, "set stdout non-blocking fail\n");
+        return 1;
+    }
 
-        FD_ZERO(&fdset);
-        FD_SET(mice_fd, &fdset);
+    if (replay_path)
+    {
+        // the recorded input instead of a mouse
+        CaptureReplay replay(output, config);
+        if (!replay.Open(replay_path))
+        {
+            //fprintf(stderr, "open replay file fail\n");
+            return 1;
+        }
+        int ret = Replay(replay, bFast, epoll_fd, output, server);
+        adaptive.Save();
+        return ret;
+    }
 
-        int ret = select(mice_fd+1, &fdset, NULL, NULL, &tv);
-        if (ret < 0)
+    // live input only, a replay has its log already
+    config.pFlight = &s_flight;
+    if (trace_path)
+    {
+        if (!s_trace.Open(trace_path))
         {
-            //fprintf(stderr, "select return error\n");
+            //fprintf(stderr, "open trace file fail\n");
             return 1;
         }
+        config.pTrace = &s_trace;
+        output.SetTrace(&s_trace);
+    }
+
+    CaptureLog log;
+    if (record_path && !log.Open(record_path))
+    {
+        //fprintf(stderr, "open record file fail\n");
+        return 1;
+    }
+
+    // evdev nodes, each with its own timer and gesture state
+    DeviceManager devices(output, config);
+    devices.Setup(epoll_fd, bGrab);
+    if (log.IsOpen())
+    {
+        devices.SetLog(&log);
+    }
+
+    // latency histograms and counters, always on, read through SIGUSR1,
+    // --stats or --stats-file
+    LatencyStats stats;
+    RuntimeCounters counters;
+    output.SetStats(&stats);
+    output.SetCounters(&counters);
+    devices.SetStats(&stats);
+    devices.SetCounters(&counters);
+    devices.SetTrace(config.pTrace);
+    StatsSocket statsSocket(stats, counters);
+    if (stats_path && !statsSocket.Listen(stats_path, epoll_fd))
+    {
+        //fprintf(stderr, "listen on stats socket fail\n");
+        return 1;
+    }
+
+    // periodic rewrite of the stats file, first one right away
+    int stats_timer_fd = -1;
+    if (stats_file)
+    {
+        stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+        if (stats_timer_fd == -1 || !statsSocket.WriteFile(stats_file))
+        {
+            //fprintf(stderr, "stats file fail\n");
+            return 1;
+        }
+        struct itimerspec its;
+        its.it_interval.tv_sec = STATS_FILE_SEC;
+        its.it_interval.tv_nsec = 0;
+        its.it_value = its.it_interval;
+        timerfd_settime(stats_timer_fd, 0, &its, NULL);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = stats_timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stats_timer_fd, &ev) == -1)
+        {
+            return 1;
+        }
+    }
+
+    // SIGUSR1 is blocked but in epoll_pwait, so no syscall elsewhere is
+    // interrupted and none is missed. SIGUSR2 dumps the flight recorder
+    sigset_t sigusr, waitmask;
+    sigemptyset(&sigusr);
+    sigaddset(&sigusr, SIGUSR1);
+    sigaddset(&sigusr, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &sigusr, &waitmask);
+    sigdelset(&waitmask, SIGUSR1);
+    sigdelset(&waitmask, SIGUSR2);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = DumpStats;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = DumpFlight;
+    sigaction(SIGUSR2, &sa, NULL);
+    sa.sa_handler = Crash;
+    sa.sa_flags = SA_RESETHAND;
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+    sigaction(SIGFPE, &sa, NULL);
+    sigaction(SIGILL, &sa, NULL);
+    sigaction(SIGABRT, &sa, NULL);
+    if (bAll)
+    {
+        if (!devices.Watch("/dev/input"))
+        {
+            //fprintf(stderr, "watch /dev/input fail\n");
+            return 1;
+        }
+    }
+    else if (evdev_path)
+    {
+        if (!devices.Add(evdev_path))
+        {
+            //fprintf(stderr, "Open evdev fail");
+            return 1;
+        }
+    }
+
+    // mousedev, the default
+    int mice_fd = -1;
+    int timer_fd = -1;
+    int nProtocol = Ps2Protocol::ID;
+    if (!bAll && !evdev_path)
+    {
+        mice_fd = open("/dev/input/mice", O_RDWR|O_NONBLOCK);
+        if (mice_fd == -1)
+        {
+            //fprintf(stderr, "Open mice fail");
+            return 1;
+        }
+
+        // wheel and buttons 4/5 if the mouse says it has them
+        nProtocol = Ps2Probe::Probe(mice_fd);
+        if (log.IsOpen())
+        {
+            log.Protocol(nProtocol, NowTick());
+        }
+
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (timer_fd == -1)
+        {
+            //fprintf(stderr, "create timerfd fail\n");
+            return 1;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = mice_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mice_fd, &ev) == -1)
+        {
+            return 1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+        {
+            return 1;
+        }
+    }
+
+    // one of them reads, picked by the probe
+    Ps2Reader<Ps2Protocol> ps2Reader(mice_fd);
+    Ps2Reader<Imps2Protocol> imps2Reader(mice_fd);
+    Ps2Reader<ExplorerProtocol> exps2Reader(mice_fd);
+    ps2Reader.SetFlight(&s_flight);
+    imps2Reader.SetFlight(&s_flight);
+    exps2Reader.SetFlight(&s_flight);
+    ps2Reader.SetCounters(&counters);
+    imps2Reader.SetCounters(&counters);
+    exps2Reader.SetCounters(&counters);
+    ButtonProcess btnProcess(TimerFdAlarm(timer_fd), output, 0, config);
+
+    // everything is allocated, lock it and get ahead of the competition
+    if (bRealtime)
+    {
+        int rt = Realtime::Enter(nPriority, nCpu);
+        if (rt != Realtime::RT_OK)
+        {
+            //fprintf(stderr, "realtime %s fail\n", Realtime::Step(rt));
+            return 1;
+        }
+    }
+    s_pAllocs = &counters;
+    while (true)
+    {
+        // no timeout, timer fds are armed only while a click is pending
+        struct epoll_event events[8];
+        tick_t wait = s_trace.IsOpen() ? NowTick() : 0;
+        int ret = epoll_pwait(epoll_fd, events, 8, -1, &waitmask);
+        counters.Add(RuntimeCounters::WAKEUPS);
+        if (s_trace.IsOpen())
+        {
+            s_trace.Slice(TraceWriter::TRACE_WAIT, 0, wait, NowTick(), ret);
+        }
+        if (s_bDumpStats)
+        {
+            s_bDumpStats = 0;
+            statsSocket.Report(STDERR_FILENO);
+        }
+        if (s_bDumpFlight)
+        {
+            s_bDumpFlight = 0;
+            s_flight.DumpTo(s_flight_path);
+        }
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            //fprintf(stderr, "epoll_wait return error\n");
+            return Fatal();
+        }
         else
         {
-            if (FD_ISSET(mice_fd, &fdset))
+            bool bMice = false;
+            bool bTimer = false;
+            for (int i = 0; i < ret; i++)
             {
-                imps2_data data;
-                while (true)
+                int fd = events[i].data.fd;
+                if (fd == mice_fd)
+                {
+                    bMice = true;
+                }
+                else if (fd == timer_fd)
                 {
-                    int nLen = read(mice_fd, &data, sizeof(data));
-                    if (nLen == 0)
+                    bTimer = true;
+                }
+                else if (devices.Owns(fd))
+                {
+                    int nRet = devices.Event(fd);
+                    if (nRet == DEVICE_QUIT)
                     {
-                        //fprintf(stderr, "End of file :)\n");
-                        return 1;
+                        // OK quit, the ring shows why
+                        s_flight.DumpTo(s_flight_path);
+                        output.Drain();
+                        s_trace.Close();
+                        adaptive.Save();
+                        return 0;
                     }
-                    else if (nLen == -1)
+                    else if (nRet == DEVICE_GONE)
                     {
-                        if (errno != EAGAIN)
-                        {
-                            //fprintf(stderr, "read fail\n");
-                            return 1;
-                        }
-                        break;
+                        //fprintf(stderr, "evdev gone\n");
+                        return Fatal();
                     }
-                    else
+                }
+                else if (server.Owns(fd))
+                {
+                    server.Event(fd, events[i].events);
+                }
+                else if (statsSocket.Owns(fd))
+                {
+                    statsSocket.Event();
+                }
+                else if (fd == stats_timer_fd)
+                {
+                    uint64_t expirations;
+                    if (read(stats_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
                     {
-                        // nLen = 1 is ack
-                        if (nLen == sizeof(data))
-                        {
-                            //printf("nLen:%d, left:%d right:%d middle:%d X:%d Y:%d Z:%d\n",
-                            //nLen, data.btn_left, data.btn_right, data.btn_middle, data.x, data.y, data.z);
-
-                            // rolling wheels
-                            if (data.z == 0 && data.x == 0 && data.y == 0)
-                            {
-                                if (data.btn_left)
-                                {
-                                    if (!btnProcess.Button(ButtonProcess::BTN_LEFT))
-                                    {
-                                        // OK quit
-                                        close(mice_fd);
-                                        return 0;
-                                    }
-                                }
-                                else if (data.btn_right)
-                                {
-                                    if (!btnProcess.Button(ButtonProcess::BTN_RIGHT))
-                                    {
-                                        // OK quit
-                                        close(mice_fd);
-                                        return 0;
-                                    }
-                                }
-                                else if (data.btn_middle)
-                                {
-                                    // pause
-                                    printf("p\n");
-                                    fflush(stdout);
-                                }
-                            }
-                            else
-                            {
-                                if (data.z != 0)
-                                {
-                                    if (data.z > 0)
-                                    {
-                                        // rolling down
-                                        printf("9\n");
-                                        fflush(stdout);
-                                    }
-                                    else
-                                    {
-                                        // rolling up
-                                        printf("0\n");
-                                        fflush(stdout);
-                                    }
-                                }
-                            }
-                        }
+                        // a full tmpfs is not worth quitting for
+                        statsSocket.WriteFile(stats_file);
                     }
                 }
+                else if (events[i].events & (EPOLLERR|EPOLLHUP))
+                {
+                    // stdout, consumer is gone
+                    return Fatal();
+                }
             }
-        }
 
-        btnProcess.Timer();
+            // input first, a second click may already be queued when timer expires
+            if (bMice)
+            {
+                int nRet = nProtocol == ExplorerProtocol::ID ? MiceInput(exps2Reader, btnProcess, log, stats, s_trace) :
+                    nProtocol == Imps2Protocol::ID ? MiceInput(imps2Reader, btnProcess, log, stats, s_trace) :
+                    MiceInput(ps2Reader, btnProcess, log, stats, s_trace);
+                if (nRet == DEVICE_QUIT)
+                {
+                    // OK quit, the ring shows why
+                    s_flight.DumpTo(s_flight_path);
+                    output.Drain();
+                    s_trace.Close();
+                    adaptive.Save();
+                    close(mice_fd);
+                    return 0;
+                }
+                else if (nRet == DEVICE_GONE)
+                {
+                    //fprintf(stderr, "read mice fail\n");
+                    return Fatal();
+                }
+            }
+
+            if (bTimer)
+            {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                {
+                    counters.Add(RuntimeCounters::TIMER_FIRES, expirations);
+                    tick_t now = NowTick();
+                    tick_t deadline;
+                    bool bDue = btnProcess.NextDeadline(deadline) && deadline <= now;
+                    if (bDue)
+                    {
+                        stats.Timer(deadline, now);
+                        stats.Batch(now);
+                    }
+                    btnProcess.Timer(now);
+                    if (bDue && s_trace.IsOpen())
+                    {
+                        s_trace.Slice(TraceWriter::TRACE_TIMER, 1, now, NowTick(), (int32_t)(now - deadline));
+                    }
+                }
+            }
+
+            // one writev for all actions of this wakeup, the rest waits
+            // for EPOLLOUT on stdout
+            if (!output.Flush())
+            {
+                //fprintf(stderr, "write stdout fail\n");
+                return Fatal();
+            }
+
+            // after the actions are out, not in the middle of a click
+            if (adaptive.Due(NowTick()))
+            {
+                adaptive.Save();
+            }
+        }
     }
 
     return 0;
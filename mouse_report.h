@@ -0,0 +1,32 @@
+// @brief: one decoded mouse report, common to the mousedev and evdev backends
+
+#ifndef MOUSE_REPORT_H
+#define MOUSE_REPORT_H
+
+#include "mono_tick.h"
+#include "wheel_accumulator.h"
+
+// same meaning as one ps/2 packet of mousedev:
+// button state plus the movement since the previous report
+struct mouse_report
+{
+    bool btn_left;
+    bool btn_right;
+    bool btn_middle;
+    // buttons 4/5, decoded but not bound to gestures
+    bool btn_side;
+    bool btn_extra;
+
+    int x;
+    int y;
+    int z;  // > 0 rolling down, < 0 rolling up
+
+    // wheels in 1/120 detent, REL_WHEEL_HI_RES and REL_HWHEEL_HI_RES
+    int z_hires;    // same sign as z
+    int w_hires;    // > 0 right
+
+    // event time, kernel timestamp or read time if backend has none
+    tick_t time;
+};
+
+#endif
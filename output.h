@@ -0,0 +1,273 @@
+// @brief: non-blocking action output with a bounded queue
+//
+// actions are queued as pre-encoded text lines and written by the event
+// loop with one writev() per batch, so a slow consumer on the other end of
+// the pipe never stalls input sampling or the double click timer.
+// actions can also go to a shared memory ring as binary records and to
+// the subscribers of a unix socket server
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "mono_tick.h"
+#include "line_queue.h"
+#include "shm_ring.h"
+#include "socket_server.h"
+#include "latency_stats.h"
+#include "runtime_counters.h"
+#include "trace_writer.h"
+
+class Output
+{
+    public:
+        Output(int fd)
+        :m_fd(fd),
+        m_bText(false),
+        m_nFlags(-1),
+        m_epoll_fd(-1),
+        m_bWaitOut(false),
+        m_pShm(NULL),
+        m_pServer(NULL),
+        m_pStats(NULL),
+        m_pCounters(NULL),
+        m_pTrace(NULL)
+        {
+        }
+
+        ~Output()
+        {
+            // stdout file description is shared with our parent
+            if (m_nFlags != -1)
+            {
+                fcntl(m_fd, F_SETFL, m_nFlags);
+            }
+        }
+
+        // text protocol to fd: switch fd to non-blocking and wait for
+        // EPOLLOUT in epoll_fd while the queue is not empty. regular files
+        // can not be polled, they are written blocking
+        bool Setup(int epoll_fd)
+        {
+            m_nFlags = fcntl(m_fd, F_GETFL);
+            if (m_nFlags == -1 || fcntl(m_fd, F_SETFL, m_nFlags | O_NONBLOCK) == -1)
+            {
+                return false;
+            }
+
+            struct epoll_event ev;
+            ev.events = 0;
+            ev.data.fd = m_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, m_fd, &ev) == 0)
+            {
+                m_epoll_fd = epoll_fd;
+            }
+            m_bText = true;
+            return true;
+        }
+
+        // tag text lines with the source device
+        void SetTag(bool bTag)
+        {
+            m_queue.SetTag(bTag);
+        }
+
+        // binary records to a shared memory ring
+        void SetShm(ShmRing *pShm)
+        {
+            m_pShm = pShm;
+        }
+
+        // text protocol to socket subscribers
+        void SetServer(SocketServer *pServer)
+        {
+            m_pServer = pServer;
+        }
+
+        // emit and write times to the latency histograms
+        void SetStats(LatencyStats *pStats)
+        {
+            m_pStats = pStats;
+        }
+
+        // actions, writes and consumer stalls, NULL is off
+        void SetCounters(RuntimeCounters *pCounters)
+        {
+            m_pCounters = pCounters;
+        }
+
+        // every writev() on the timeline, NULL is off
+        void SetTrace(TraceWriter *pTrace)
+        {
+            m_pTrace = pTrace;
+        }
+
+        bool Pending()
+        {
+            return !m_queue.Empty();
+        }
+
+        // queue one action, written by the next Flush().
+        // time is the event time the action was decided on, dev the source,
+        // count the wheel detents it stands for, wheel its axis and
+        // direction (LineQueue), 0 for a button action
+        void Emit(char code, tick_t time, int dev, int count = 1, int wheel = 0)
+        {
+            if (m_pStats)
+            {
+                m_pStats->Emitted(NowTick());
+            }
+            if (m_pCounters)
+            {
+                m_pCounters->Add(RuntimeCounters::ACTIONS);
+            }
+            if (m_pShm)
+            {
+                m_pShm->Push(code, time, dev, count);
+            }
+            if (m_pServer)
+            {
+                m_pServer->Emit(code, dev, count, wheel);
+            }
+            if (!m_bText)
+            {
+                return;
+            }
+
+            if (!m_queue.Full())
+            {
+                m_queue.Push(code, dev, count, wheel);
+                return;
+            }
+
+            // wheel steps are merged into queued ones, nothing is dropped
+            if (m_queue.Coalesce(code, dev, count, wheel))
+            {
+                return;
+            }
+
+            // no room and nothing to merge, one more try without waiting:
+            // the loop must not block on the consumer, the timers and the
+            // other devices go on
+            if (Flush() && !m_queue.Full())
+            {
+                m_queue.Push(code, dev, count, wheel);
+                return;
+            }
+            if (m_pCounters)
+            {
+                m_pCounters->Add(RuntimeCounters::OUTPUT_DROPS);
+            }
+        }
+
+        // write as much of the queue as the fd takes with one writev(),
+        // return false on write error (consumer is gone)
+        bool Flush()
+        {
+            if (m_pServer)
+            {
+                m_pServer->Flush();
+            }
+
+            while (Pending())
+            {
+                tick_t start = m_pStats || m_pTrace ? NowTick() : 0;
+                ssize_t nLen = m_queue.Write(m_fd, false);
+                if (m_pStats || m_pTrace)
+                {
+                    tick_t end = NowTick();
+                    if (m_pStats)
+                    {
+                        m_pStats->Write(start, end);
+                    }
+                    if (m_pTrace)
+                    {
+                        m_pTrace->Slice(TraceWriter::TRACE_WRITE, 0, start, end, nLen);
+                    }
+                }
+                if (m_pCounters)
+                {
+                    m_pCounters->Add(RuntimeCounters::FLUSHES);
+                }
+                if (nLen == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (errno != EAGAIN)
+                    {
+                        return false;
+                    }
+                    if (m_pCounters)
+                    {
+                        m_pCounters->Add(RuntimeCounters::WRITE_EAGAIN);
+                    }
+                    break;
+                }
+            }
+
+            WaitOut(Pending());
+            return true;
+        }
+
+        // blocking write of the whole queue, before exit.
+        // socket subscribers get what fits without waiting
+        bool Drain()
+        {
+            if (!Flush())
+            {
+                return false;
+            }
+            while (Pending())
+            {
+                struct pollfd pfd;
+                pfd.fd = m_fd;
+                pfd.events = POLLOUT;
+                poll(&pfd, 1, -1);
+                if (!Flush())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        void WaitOut(bool bWait)
+        {
+            if (m_epoll_fd == -1 || bWait == m_bWaitOut)
+            {
+                return;
+            }
+
+            struct epoll_event ev;
+            ev.events = bWait ? EPOLLOUT : 0;
+            ev.data.fd = m_fd;
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, m_fd, &ev);
+            m_bWaitOut = bWait;
+        }
+
+    private:
+        int m_fd;
+        bool m_bText;
+        int m_nFlags;
+
+        // epoll_fd watching m_fd, -1 if m_fd is not pollable
+        int m_epoll_fd;
+        bool m_bWaitOut;
+
+        LineQueue m_queue;
+        ShmRing *m_pShm;
+        SocketServer *m_pServer;
+        LatencyStats *m_pStats;
+        RuntimeCounters *m_pCounters;
+        TraceWriter *m_pTrace;
+};
+
+#endif
@@ -0,0 +1,378 @@
+// @brief: bulk decoder of IMPS/2 packets into a structure of arrays
+//
+// Ps2Reader cuts and decodes one packet at a time. recorded captures and
+// high rate mice come as long runs of aligned packets, Imps2Batch decodes
+// such a run many packets per step with NEON, AVX2 or SSE2, or 64 bit
+// SWAR words elsewhere (ARM9 has no SIMD). no bitfields and no branch per
+// packet: every step checks the sync bit and ACK of all its packets at
+// once and only falls back to bytes when one of them is off. decoding
+// stops at the first packet that is not in frame, the caller resyncs the
+// way Ps2Reader does
+//
+// Imps2BatchReader puts it behind the Feed()/Next() of Ps2Reader for the
+// IMPS/2 records of a capture replay. a live mouse hands Ps2Reader one or
+// two packets per read, too few for a batch to pay off
+
+#ifndef PS2_BATCH_H
+#define PS2_BATCH_H
+
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "imps2_reader.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PS2_BATCH_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define PS2_BATCH_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PS2_BATCH_SSE2
+#endif
+
+// packets of one batch, index i is the i-th packet
+struct ps2_batch
+{
+    enum { MAX = 256 };
+
+    unsigned count;
+    uint8_t buttons[MAX];   // bit 0 left, 1 right, 2 middle
+    uint8_t status[MAX];    // bit 0 x sign, 1 y sign, 2 x overflow, 3 y overflow
+    int16_t x[MAX];
+    int16_t y[MAX];
+    int16_t z[MAX];         // > 0 rolling down
+};
+
+class Imps2Batch
+{
+    public:
+        enum {
+            SIZE = 4,
+            PS2_ACK = 0xfa,
+            FRAME_SYNC = 0x08
+        };
+
+    public:
+        // name of the vector path compiled in
+        static const char *Path()
+        {
+#if defined(PS2_BATCH_NEON)
+            return "neon";
+#elif defined(PS2_BATCH_AVX2)
+            return "avx2";
+#elif defined(PS2_BATCH_SSE2)
+            return "sse2";
+#else
+            return "swar";
+#endif
+        }
+
+        // up to ps2_batch::MAX packets of the nLen bytes at p, the first
+        // byte starts a packet. return the packets decoded, also in
+        // batch.count. a partial packet at the end is left over
+        static unsigned Decode(const uint8_t *p, unsigned nLen, ps2_batch &batch)
+        {
+            unsigned nMax = nLen / SIZE;
+            if (nMax > (unsigned)ps2_batch::MAX)
+            {
+                nMax = ps2_batch::MAX;
+            }
+
+            unsigned i = 0;
+            while (i + STEP <= nMax && Step(p + i * SIZE, batch, i))
+            {
+                i += STEP;
+            }
+            while (i < nMax && One(p + i * SIZE, batch, i))
+            {
+                i++;
+            }
+            batch.count = i;
+            return i;
+        }
+
+    private:
+#if defined(PS2_BATCH_NEON) || defined(PS2_BATCH_AVX2)
+        enum { STEP = 16 };
+#elif defined(PS2_BATCH_SSE2)
+        enum { STEP = 8 };
+#else
+        enum { STEP = 2 };
+#endif
+
+        // first byte has the sync bit and is no ACK
+        static bool InFrame(uint8_t head)
+        {
+            return (head & FRAME_SYNC) && head != PS2_ACK;
+        }
+
+        static bool One(const uint8_t *p, ps2_batch &batch, unsigned i)
+        {
+            if (!InFrame(p[0]))
+            {
+                return false;
+            }
+            batch.buttons[i] = p[0] & 0x07;
+            batch.status[i] = p[0] >> 4;
+            batch.x[i] = (int8_t)p[1];
+            batch.y[i] = (int8_t)p[2];
+            batch.z[i] = (int8_t)p[3];
+            return true;
+        }
+
+#if defined(PS2_BATCH_NEON)
+        // vld4 splits 16 packets into their four bytes
+        static bool Step(const uint8_t *p, ps2_batch &batch, unsigned i)
+        {
+            uint8x16x4_t v = vld4q_u8(p);
+            uint8x16_t head = v.val[0];
+            uint8x16_t bad = vorrq_u8(vceqq_u8(vandq_u8(head, vdupq_n_u8(FRAME_SYNC)), vdupq_n_u8(0)),
+                    vceqq_u8(head, vdupq_n_u8(PS2_ACK)));
+            uint64x2_t bad64 = vreinterpretq_u64_u8(bad);
+            if (vgetq_lane_u64(bad64, 0) | vgetq_lane_u64(bad64, 1))
+            {
+                return false;
+            }
+
+            vst1q_u8(batch.buttons + i, vandq_u8(head, vdupq_n_u8(0x07)));
+            vst1q_u8(batch.status + i, vshrq_n_u8(head, 4));
+            Widen(v.val[1], batch.x + i);
+            Widen(v.val[2], batch.y + i);
+            Widen(v.val[3], batch.z + i);
+            return true;
+        }
+
+        static void Widen(uint8x16_t v, int16_t *out)
+        {
+            int8x16_t s = vreinterpretq_s8_u8(v);
+            vst1q_s16(out, vmovl_s8(vget_low_s8(s)));
+            vst1q_s16(out + 8, vmovl_s8(vget_high_s8(s)));
+        }
+#elif defined(PS2_BATCH_AVX2)
+        // a packet is one 32 bit lane, 8 packets per register
+        static bool Step(const uint8_t *p, ps2_batch &batch, unsigned i)
+        {
+            __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+            __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+            __m256i mask = _mm256_set1_epi32(0xff);
+            __m256i head16 = Pack(_mm256_and_si256(v0, mask), _mm256_and_si256(v1, mask));
+            __m128i head = _mm_packus_epi16(_mm256_castsi256_si128(head16),
+                    _mm256_extracti128_si256(head16, 1));
+            if (!HeadsInFrame(head))
+            {
+                return false;
+            }
+            StoreHead(head, batch, i);
+
+            // byte n of a lane, sign extended
+            _mm256_storeu_si256((__m256i *)(batch.x + i),
+                    Pack(_mm256_srai_epi32(_mm256_slli_epi32(v0, 16), 24), _mm256_srai_epi32(_mm256_slli_epi32(v1, 16), 24)));
+            _mm256_storeu_si256((__m256i *)(batch.y + i),
+                    Pack(_mm256_srai_epi32(_mm256_slli_epi32(v0, 8), 24), _mm256_srai_epi32(_mm256_slli_epi32(v1, 8), 24)));
+            _mm256_storeu_si256((__m256i *)(batch.z + i),
+                    Pack(_mm256_srai_epi32(v0, 24), _mm256_srai_epi32(v1, 24)));
+            return true;
+        }
+
+        // 16 int32 to 16 int16 in order, packs works per 128 bit lane
+        static __m256i Pack(__m256i a, __m256i b)
+        {
+            return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+        }
+#elif defined(PS2_BATCH_SSE2)
+        // a packet is one 32 bit lane, 4 packets per register
+        static bool Step(const uint8_t *p, ps2_batch &batch, unsigned i)
+        {
+            __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+            __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+
+            __m128i mask = _mm_set1_epi32(0xff);
+            __m128i head16 = _mm_packs_epi32(_mm_and_si128(v0, mask), _mm_and_si128(v1, mask));
+            __m128i head = _mm_packus_epi16(head16, head16);
+            if (!HeadsInFrame(head))
+            {
+                return false;
+            }
+            StoreHead(head, batch, i);
+
+            // byte n of a lane, sign extended
+            _mm_storeu_si128((__m128i *)(batch.x + i),
+                    _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(v0, 16), 24), _mm_srai_epi32(_mm_slli_epi32(v1, 16), 24)));
+            _mm_storeu_si128((__m128i *)(batch.y + i),
+                    _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(v0, 8), 24), _mm_srai_epi32(_mm_slli_epi32(v1, 8), 24)));
+            _mm_storeu_si128((__m128i *)(batch.z + i),
+                    _mm_packs_epi32(_mm_srai_epi32(v0, 24), _mm_srai_epi32(v1, 24)));
+            return true;
+        }
+#else
+        // one 64 bit word is two packets, p[0] in the low byte
+        static bool Step(const uint8_t *p, ps2_batch &batch, unsigned i)
+        {
+            uint64_t w;
+            memcpy(&w, p, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            w = __builtin_bswap64(w);
+#endif
+            const uint64_t SYNC = 0x0000000800000008ULL;
+            uint32_t h0 = (uint32_t)w & 0xff;
+            uint32_t h1 = (uint32_t)(w >> 32) & 0xff;
+            if ((w & SYNC) != SYNC || h0 == PS2_ACK || h1 == PS2_ACK)
+            {
+                return false;
+            }
+
+            batch.buttons[i] = h0 & 0x07;
+            batch.buttons[i + 1] = h1 & 0x07;
+            batch.status[i] = h0 >> 4;
+            batch.status[i + 1] = h1 >> 4;
+            batch.x[i] = (int8_t)(w >> 8);
+            batch.x[i + 1] = (int8_t)(w >> 40);
+            batch.y[i] = (int8_t)(w >> 16);
+            batch.y[i + 1] = (int8_t)(w >> 48);
+            batch.z[i] = (int8_t)(w >> 24);
+            batch.z[i + 1] = (int8_t)(w >> 56);
+            return true;
+        }
+#endif
+
+#if defined(PS2_BATCH_AVX2) || defined(PS2_BATCH_SSE2)
+        // head bytes in the low bytes of head, the high ones repeat them
+        static bool HeadsInFrame(__m128i head)
+        {
+            __m128i bad = _mm_or_si128(
+                    _mm_cmpeq_epi8(_mm_and_si128(head, _mm_set1_epi8(FRAME_SYNC)), _mm_setzero_si128()),
+                    _mm_cmpeq_epi8(head, _mm_set1_epi8((char)PS2_ACK)));
+            return _mm_movemask_epi8(bad) == 0;
+        }
+
+        static void StoreHead(__m128i head, ps2_batch &batch, unsigned i)
+        {
+            __m128i buttons = _mm_and_si128(head, _mm_set1_epi8(0x07));
+            __m128i status = _mm_and_si128(_mm_srli_epi16(head, 4), _mm_set1_epi8(0x0f));
+            if (STEP == 16)
+            {
+                _mm_storeu_si128((__m128i *)(batch.buttons + i), buttons);
+                _mm_storeu_si128((__m128i *)(batch.status + i), status);
+            }
+            else
+            {
+                _mm_storel_epi64((__m128i *)(batch.buttons + i), buttons);
+                _mm_storel_epi64((__m128i *)(batch.status + i), status);
+            }
+        }
+#endif
+};
+
+// Ps2Reader<Imps2Protocol> for replayed reads, same reports: aligned runs
+// of a read go through Imps2Batch, a byte out of frame, the bytes of a
+// frame cut by the end of a read and the rest of it in the next read go
+// through Ps2Reader, which skips and carries them the usual way
+class Imps2BatchReader
+{
+    public:
+        enum { SIZE = Imps2Batch::SIZE };
+
+    public:
+        Imps2BatchReader()
+        :m_reader(-1),
+        m_p(NULL),
+        m_nLen(0),
+        m_nNext(0)
+        {
+            m_batch.count = 0;
+        }
+
+        // bytes of a replayed read, they have to stay until Next() is false
+        void Feed(const BYTE *p, unsigned nLen)
+        {
+            m_p = p;
+            m_nLen = nLen;
+            m_nNext = 0;
+            m_batch.count = 0;
+        }
+
+        // drop the bytes fed and a partial frame carried
+        void Reset()
+        {
+            m_reader.Reset();
+            Feed(NULL, 0);
+        }
+
+        // next complete frame, false if the bytes fed hold no more
+        bool Next(mouse_report &report, tick_t time)
+        {
+            while (true)
+            {
+                if (m_nNext < m_batch.count)
+                {
+                    Report(m_nNext++, time, report);
+                    return true;
+                }
+                if (m_reader.Next(report, time))
+                {
+                    return true;
+                }
+                if (m_nLen == 0)
+                {
+                    return false;
+                }
+
+                if (m_reader.Pending() || m_nLen < (unsigned)SIZE)
+                {
+                    // the rest of a cut frame, byte by byte until the
+                    // reader has it, or the start of one
+                    Carry(m_reader.Pending() ? 1 : m_nLen);
+                    continue;
+                }
+
+                unsigned n = Imps2Batch::Decode(m_p, m_nLen, m_batch);
+                m_nNext = 0;
+                m_p += n * SIZE;
+                m_nLen -= n * SIZE;
+                if (n == 0)
+                {
+                    // out of frame, the reader skips it
+                    Carry(1);
+                }
+            }
+        }
+
+    private:
+        void Carry(unsigned nLen)
+        {
+            m_reader.Feed(m_p, nLen);
+            m_p += nLen;
+            m_nLen -= nLen;
+        }
+
+        // what Imps2Protocol::Decode() makes of packet i
+        void Report(unsigned i, tick_t time, mouse_report &report) const
+        {
+            report.btn_left = m_batch.buttons[i] & 0x01;
+            report.btn_right = m_batch.buttons[i] & 0x02;
+            report.btn_middle = m_batch.buttons[i] & 0x04;
+            report.btn_side = false;
+            report.btn_extra = false;
+            report.x = m_batch.x[i];
+            report.y = m_batch.y[i];
+            report.z = m_batch.z[i];
+            report.z_hires = m_batch.z[i] * WheelAccumulator::UNITS_PER_DETENT;
+            report.w_hires = 0;
+            report.time = time;
+        }
+
+    private:
+        Ps2Reader<Imps2Protocol> m_reader;
+        ps2_batch m_batch;
+        const BYTE *m_p;
+        unsigned m_nLen;
+        // next packet of m_batch to report
+        unsigned m_nNext;
+};
+
+#endif
@@ -0,0 +1,117 @@
+// @brief: low jitter mode (--realtime): SCHED_FIFO, locked and prefaulted
+//         memory, optionally pinned to one CPU
+//
+// a click window closes on a timer, when the process is scheduled late
+// behind another busy process (the audio decoder) the click comes out
+// late, or a second click is read after its window looked closed. with
+// SCHED_FIFO above the competitor the timer wakeup preempts it. page
+// faults are the other source of latency: mlockall() keeps what is mapped
+// resident, MCL_FUTURE does the same for what comes, the stack is touched
+// once so its pages exist, and malloc neither trims nor mmaps so a freed
+// block is never given back and faulted in again
+//
+// call Enter() after setup, before the loop: what is allocated by then is
+// locked. see bench/jitter_bench.cpp for the effect on timer lateness
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <sys/mman.h>
+#include <sched.h>
+#include <malloc.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+class Realtime
+{
+    public:
+        enum {
+            DEFAULT_PRIORITY = 20,
+            PREFAULT_STACK = 256 * 1024
+        };
+
+        enum {
+            RT_OK,
+            RT_MEMORY,      // mlockall() failed, RLIMIT_MEMLOCK or no CAP_IPC_LOCK
+            RT_AFFINITY,    // no such CPU
+            RT_SCHEDULER    // SCHED_FIFO not permitted, no CAP_SYS_NICE or RLIMIT_RTPRIO
+        };
+
+    public:
+        // "prio[,cpu]", cpu -1 is not pinned. false on a bad argument
+        static bool Parse(const char *arg, int &priority, int &cpu)
+        {
+            priority = DEFAULT_PRIORITY;
+            cpu = -1;
+            if (arg == NULL || *arg == '\0')
+            {
+                return true;
+            }
+            char *end;
+            priority = strtol(arg, &end, 10);
+            if (*end == ',')
+            {
+                cpu = strtol(end + 1, &end, 10);
+                if (cpu < 0)
+                {
+                    return false;
+                }
+            }
+            return *end == '\0' && priority >= sched_get_priority_min(SCHED_FIFO) &&
+                priority <= sched_get_priority_max(SCHED_FIFO);
+        }
+
+        // RT_OK, or the step that failed with errno set. the steps before
+        // it stay in effect
+        static int Enter(int priority, int cpu)
+        {
+            // freed memory stays in the heap, no mmap for big blocks
+            mallopt(M_TRIM_THRESHOLD, -1);
+            mallopt(M_MMAP_MAX, 0);
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+            {
+                return RT_MEMORY;
+            }
+            Prefault();
+
+            if (cpu >= 0)
+            {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                if (sched_setaffinity(0, sizeof(set), &set) == -1)
+                {
+                    return RT_AFFINITY;
+                }
+            }
+
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = priority;
+            if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+            {
+                return RT_SCHEDULER;
+            }
+            return RT_OK;
+        }
+
+        static const char *Step(int ret)
+        {
+            static const char *steps[] = { "ok", "mlockall", "sched_setaffinity", "sched_setscheduler" };
+            return steps[ret];
+        }
+
+    private:
+        // the stack the loop will use, faulted in and locked now
+        static void __attribute__((noinline)) Prefault()
+        {
+            volatile char stack[PREFAULT_STACK];
+            for (unsigned i = 0; i < sizeof(stack); i += 4096)
+            {
+                stack[i] = 0;
+            }
+        }
+};
+
+#endif
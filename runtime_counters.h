@@ -0,0 +1,104 @@
+// @brief: event counters of the main loop, readers and output, for
+//         monitoring fielded boxes (stats_socket.h)
+//
+// every counter sits on a cache line of its own, so counting one never
+// drags in the line of another and a reader of the stats never shares a
+// dirty line with the hot ones. one thread counts, plain increments,
+// 64 bit so they do not wrap between two scrapes. Name() and Help() are
+// for the Prometheus text the stats socket serves
+
+#ifndef RUNTIME_COUNTERS_H
+#define RUNTIME_COUNTERS_H
+
+#include <string.h>
+#include <stdint.h>
+
+class RuntimeCounters
+{
+    public:
+        enum {
+            // 32 on the ARM926, 64 elsewhere; the bigger one fits both
+            CACHE_LINE = 64
+        };
+
+        enum {
+            WAKEUPS,        // epoll returns
+            READS,          // read() of an input fd with data
+            READ_EAGAIN,    // read() with nothing there
+            SHORT_READS,    // read() not a multiple of the packet/event size
+            PACKETS,        // mousedev frames decoded
+            ACK_BYTES,      // 0xfa bytes skipped
+            SYNC_BYTES,     // bytes out of frame skipped
+            OVERFLOWS,      // x/y overflow bits set in a frame
+            EVENTS_DROPPED, // evdev SYN_DROPPED
+            REPORTS,        // evdev reports
+            TIMER_FIRES,    // timerfd expirations served
+            ACTIONS,        // actions emitted
+            FLUSHES,        // writev() of the output queue
+            WRITE_EAGAIN,   // writev() that found the consumer full
+            OUTPUT_DROPS,   // actions lost, queue full of button actions
+            ALLOCS,         // operator new in the loop, hotplug only
+            COUNTERS
+        };
+
+    public:
+        RuntimeCounters()
+        {
+            memset(m_slot, 0, sizeof(m_slot));
+        }
+
+        void Add(int i, uint64_t n = 1)
+        {
+            m_slot[i].value += n;
+        }
+
+        uint64_t Get(int i)
+        {
+            return m_slot[i].value;
+        }
+
+        static const char *Name(int i)
+        {
+            static const char *names[COUNTERS] = {
+                "wakeups", "reads", "read_eagain", "short_reads", "packets",
+                "ack_bytes", "sync_bytes", "overflows", "events_dropped", "reports",
+                "timer_fires", "actions", "flushes", "write_eagain", "output_drops",
+                "allocs"
+            };
+            return names[i];
+        }
+
+        static const char *Help(int i)
+        {
+            static const char *help[COUNTERS] = {
+                "Returns of the event loop wait",
+                "Reads of an input fd that returned data",
+                "Reads of an input fd that found nothing",
+                "Reads not a multiple of the packet or event size",
+                "Mousedev packets decoded",
+                "PS/2 ACK bytes skipped",
+                "Bytes out of frame skipped",
+                "Mousedev packets with an x or y overflow bit",
+                "Evdev SYN_DROPPED, kernel buffer overruns",
+                "Evdev reports decoded",
+                "Expirations of the gesture timers",
+                "Actions emitted",
+                "Writes of the output queue",
+                "Writes of the output queue that found the consumer full",
+                "Actions dropped because the consumer left the queue full of button actions",
+                "Heap allocations in the event loop, a device plugged in is the only one expected"
+            };
+            return help[i];
+        }
+
+    private:
+        struct slot
+        {
+            uint64_t value;
+            char pad[CACHE_LINE - sizeof(uint64_t)];
+        } __attribute__((aligned(CACHE_LINE)));
+
+        slot m_slot[COUNTERS];
+};
+
+#endif
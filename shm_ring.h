@@ -0,0 +1,260 @@
+// @brief: single producer single consumer ring of binary action records
+//         in a POSIX shared memory segment, for consumers on the same host
+//
+// the producer (mouse_capture -s name) creates /dev/shm/name, a consumer
+// maps it with ShmRingReader. the consumer can poll head without any
+// syscall, or sleep on the head word with FUTEX_WAIT; the producer only
+// does FUTEX_WAKE when a consumer announced that it sleeps. an eventfd
+// can not be shared with unrelated processes, a futex in the segment can.
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+// one action, 16 bytes
+struct shm_action
+{
+    int64_t time;   // CLOCK_MONOTONIC in us
+    uint32_t seq;   // producer sequence number, gaps are dropped records
+    uint16_t dev;   // source device id
+    uint8_t code;   // action character of the text protocol
+    uint8_t count;  // wheel detents of the action, 0 from old producers is 1
+};
+
+enum {
+    SHM_RING_MAGIC = 0x4d434150,    // "MCAP"
+    SHM_RING_VERSION = 1,
+    SHM_RING_SIZE = 256,            // records, power of two
+    SHM_CACHE_LINE = 64
+};
+
+// head and tail on their own cache lines
+struct shm_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t record_size;
+    uint32_t dropped;   // records lost because ring was full
+    char pad0[SHM_CACHE_LINE - 5 * sizeof(uint32_t)];
+
+    // written by producer, futex word
+    volatile uint32_t head;
+    char pad1[SHM_CACHE_LINE - sizeof(uint32_t)];
+
+    // written by consumer
+    volatile uint32_t tail;
+    volatile uint32_t sleeping;   // consumer waits on head
+    char pad2[SHM_CACHE_LINE - 2 * sizeof(uint32_t)];
+};
+
+struct shm_ring
+{
+    shm_ring_header hdr;
+    shm_action records[SHM_RING_SIZE];
+};
+
+inline long ShmFutex(volatile uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+    // shared futex, no FUTEX_PRIVATE_FLAG
+    return syscall(SYS_futex, (uint32_t *)addr, op, val, timeout, NULL, 0);
+}
+
+// producer side
+class ShmRing
+{
+    public:
+        ShmRing()
+        :m_ring(NULL)
+        {
+        }
+
+        ~ShmRing()
+        {
+            if (m_ring)
+            {
+                munmap(m_ring, sizeof(shm_ring));
+            }
+        }
+
+        // create or reset the segment
+        bool Open(const char *name)
+        {
+            int fd = shm_open(name, O_CREAT|O_RDWR, 0644);
+            if (fd == -1)
+            {
+                return false;
+            }
+            if (ftruncate(fd, sizeof(shm_ring)) == -1)
+            {
+                close(fd);
+                return false;
+            }
+            void *p = mmap(NULL, sizeof(shm_ring), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED)
+            {
+                return false;
+            }
+
+            m_ring = (shm_ring *)p;
+            memset(&m_ring->hdr, 0, sizeof(m_ring->hdr));
+            m_ring->hdr.size = SHM_RING_SIZE;
+            m_ring->hdr.record_size = sizeof(shm_action);
+            m_ring->hdr.version = SHM_RING_VERSION;
+            __sync_synchronize();
+            // consumers check magic last
+            m_ring->hdr.magic = SHM_RING_MAGIC;
+            return true;
+        }
+
+        bool IsOpen()
+        {
+            return m_ring != NULL;
+        }
+
+        // a few stores, a syscall only if the consumer sleeps
+        void Push(char code, int64_t time, int dev, int count = 1)
+        {
+            // a record holds 255 detents, more go as several records
+            for (; count > UINT8_MAX; count -= UINT8_MAX)
+            {
+                Record(code, time, dev, UINT8_MAX);
+            }
+            Record(code, time, dev, count);
+        }
+
+    private:
+        void Record(char code, int64_t time, int dev, int count)
+        {
+            shm_ring_header &hdr = m_ring->hdr;
+            uint32_t head = hdr.head;
+            if (head - hdr.tail == SHM_RING_SIZE)
+            {
+                // consumer does not keep up, drop newest
+                hdr.dropped++;
+                return;
+            }
+
+            shm_action &rec = m_ring->records[head & (SHM_RING_SIZE - 1)];
+            rec.time = time;
+            rec.seq = head;
+            rec.dev = dev;
+            rec.code = code;
+            rec.count = count;
+
+            // record before head, head before sleeping check
+            __sync_synchronize();
+            hdr.head = head + 1;
+            __sync_synchronize();
+            if (hdr.sleeping)
+            {
+                ShmFutex(&hdr.head, FUTEX_WAKE, 1, NULL);
+            }
+        }
+
+    private:
+        shm_ring *m_ring;
+};
+
+// consumer side, for integrations that include this header
+class ShmRingReader
+{
+    public:
+        ShmRingReader()
+        :m_ring(NULL)
+        {
+        }
+
+        ~ShmRingReader()
+        {
+            if (m_ring)
+            {
+                munmap(m_ring, sizeof(shm_ring));
+            }
+        }
+
+        bool Open(const char *name)
+        {
+            int fd = shm_open(name, O_RDWR, 0);
+            if (fd == -1)
+            {
+                return false;
+            }
+            void *p = mmap(NULL, sizeof(shm_ring), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED)
+            {
+                return false;
+            }
+
+            m_ring = (shm_ring *)p;
+            if (m_ring->hdr.magic != SHM_RING_MAGIC || m_ring->hdr.version != SHM_RING_VERSION)
+            {
+                munmap(m_ring, sizeof(shm_ring));
+                m_ring = NULL;
+                return false;
+            }
+            // skip what was produced before we came
+            m_ring->hdr.tail = m_ring->hdr.head;
+            return true;
+        }
+
+        // no syscall, false if ring is empty
+        bool Poll(shm_action &rec)
+        {
+            shm_ring_header &hdr = m_ring->hdr;
+            uint32_t tail = hdr.tail;
+            if (tail == hdr.head)
+            {
+                return false;
+            }
+            __sync_synchronize();
+            rec = m_ring->records[tail & (SHM_RING_SIZE - 1)];
+            __sync_synchronize();
+            hdr.tail = tail + 1;
+            return true;
+        }
+
+        // sleep until a record is available, timeout NULL waits forever
+        bool Wait(shm_action &rec, const struct timespec *timeout)
+        {
+            shm_ring_header &hdr = m_ring->hdr;
+            while (!Poll(rec))
+            {
+                uint32_t tail = hdr.tail;
+                hdr.sleeping = 1;
+                __sync_synchronize();
+                if (hdr.head == tail)
+                {
+                    long ret = ShmFutex(&hdr.head, FUTEX_WAIT, tail, timeout);
+                    hdr.sleeping = 0;
+                    if (ret == -1 && errno == ETIMEDOUT)
+                    {
+                        return false;
+                    }
+                }
+                hdr.sleeping = 0;
+            }
+            return true;
+        }
+
+        uint32_t Dropped()
+        {
+            return m_ring->hdr.dropped;
+        }
+
+    private:
+        shm_ring *m_ring;
+};
+
+#endif
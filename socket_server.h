@@ -0,0 +1,325 @@
+// @brief: unix domain socket server, fans the text actions out to many
+//         subscribers from the main epoll loop
+//
+// every client has its own non-blocking write queue. a client that does
+// not keep up is handled by the slow client policy, the others never wait
+// for it
+
+#ifndef SOCKET_SERVER_H
+#define SOCKET_SERVER_H
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "line_queue.h"
+
+class SocketServer
+{
+    public:
+        enum { MAX_CLIENTS = 16 };
+
+        // what to do with a client whose queue is full
+        enum {
+            POLICY_DROP,        // drop the new action
+            POLICY_COALESCE,    // coalesce wheel actions, drop if still full
+            POLICY_DISCONNECT   // close the client
+        };
+
+    public:
+        SocketServer()
+        :m_listen_fd(-1),
+        m_epoll_fd(-1),
+        m_nPolicy(POLICY_COALESCE),
+        m_bTag(false)
+        {
+            m_path[0] = '\0';
+            for (int i = 0; i < MAX_CLIENTS; i++)
+            {
+                m_clients[i].fd = -1;
+            }
+        }
+
+        ~SocketServer()
+        {
+            for (int i = 0; i < MAX_CLIENTS; i++)
+            {
+                if (m_clients[i].fd != -1)
+                {
+                    close(m_clients[i].fd);
+                }
+            }
+            if (m_listen_fd != -1)
+            {
+                close(m_listen_fd);
+                unlink(m_path);
+            }
+        }
+
+        // policy name as given on the command line, -1 if unknown
+        static int ParsePolicy(const char *name)
+        {
+            if (strcmp(name, "drop") == 0)
+            {
+                return POLICY_DROP;
+            }
+            else if (strcmp(name, "coalesce") == 0)
+            {
+                return POLICY_COALESCE;
+            }
+            else if (strcmp(name, "disconnect") == 0)
+            {
+                return POLICY_DISCONNECT;
+            }
+            return -1;
+        }
+
+        bool Listen(const char *path, int epoll_fd, int policy)
+        {
+            struct sockaddr_un addr;
+            if (strlen(path) >= sizeof(addr.sun_path))
+            {
+                return false;
+            }
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, path);
+
+            m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (m_listen_fd == -1)
+            {
+                return false;
+            }
+            fcntl(m_listen_fd, F_SETFL, O_NONBLOCK);
+            fcntl(m_listen_fd, F_SETFD, FD_CLOEXEC);
+
+            // stale socket of a previous run
+            unlink(path);
+            if (bind(m_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+                listen(m_listen_fd, MAX_CLIENTS) == -1)
+            {
+                close(m_listen_fd);
+                m_listen_fd = -1;
+                return false;
+            }
+            strcpy(m_path, path);
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = m_listen_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev) == -1)
+            {
+                return false;
+            }
+            m_epoll_fd = epoll_fd;
+            m_nPolicy = policy;
+            return true;
+        }
+
+        // tag each line with its source device
+        void SetTag(bool bTag)
+        {
+            m_bTag = bTag;
+        }
+
+        bool IsListen()
+        {
+            return m_listen_fd != -1;
+        }
+
+        // fd belongs to the server, events are for Event()
+        bool Owns(int fd)
+        {
+            return fd == m_listen_fd || Find(fd) != NULL;
+        }
+
+        void Event(int fd, uint32_t events)
+        {
+            if (fd == m_listen_fd)
+            {
+                Accept();
+                return;
+            }
+
+            client *c = Find(fd);
+            if (c == NULL)
+            {
+                return;
+            }
+
+            if (events & EPOLLIN)
+            {
+                // subscribers do not talk, read only to see the close
+                char buf[64];
+                ssize_t nLen = read(c->fd, buf, sizeof(buf));
+                if (nLen == 0 || (nLen == -1 && errno != EAGAIN && errno != EINTR))
+                {
+                    Close(*c);
+                    return;
+                }
+            }
+            if (events & (EPOLLERR|EPOLLHUP))
+            {
+                Close(*c);
+                return;
+            }
+            if (events & EPOLLOUT)
+            {
+                FlushClient(*c);
+            }
+        }
+
+        // queue one action for every client
+        void Emit(char code, int dev, int count = 1, int wheel = 0)
+        {
+            for (int i = 0; i < MAX_CLIENTS; i++)
+            {
+                client &c = m_clients[i];
+                if (c.fd == -1)
+                {
+                    continue;
+                }
+
+                if (!c.queue.Full())
+                {
+                    c.queue.Push(code, dev, count, wheel);
+                }
+                else if (m_nPolicy == POLICY_DISCONNECT)
+                {
+                    Close(c);
+                }
+                else if (m_nPolicy == POLICY_DROP || !c.queue.Coalesce(code, dev, count, wheel))
+                {
+                    c.nDropped++;
+                }
+            }
+        }
+
+        // one write per client with queued actions
+        void Flush()
+        {
+            for (int i = 0; i < MAX_CLIENTS; i++)
+            {
+                client &c = m_clients[i];
+                if (c.fd != -1 && !c.queue.Empty())
+                {
+                    FlushClient(c);
+                }
+            }
+        }
+
+    private:
+        struct client
+        {
+            int fd;
+            bool bWaitOut;
+            unsigned nDropped;
+            LineQueue queue;
+        };
+
+        client *Find(int fd)
+        {
+            for (int i = 0; i < MAX_CLIENTS; i++)
+            {
+                if (m_clients[i].fd == fd)
+                {
+                    return &m_clients[i];
+                }
+            }
+            return NULL;
+        }
+
+        void Accept()
+        {
+            while (true)
+            {
+                int fd = accept(m_listen_fd, NULL, NULL);
+                if (fd == -1)
+                {
+                    return;
+                }
+
+                client *c = Find(-1);
+                if (c == NULL)
+                {
+                    // full house
+                    close(fd);
+                    continue;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+                struct epoll_event ev;
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+                if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+                {
+                    close(fd);
+                    continue;
+                }
+                c->fd = fd;
+                c->bWaitOut = false;
+                c->nDropped = 0;
+                c->queue.Clear();
+                c->queue.SetTag(m_bTag);
+            }
+        }
+
+        void Close(client &c)
+        {
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, c.fd, NULL);
+            close(c.fd);
+            c.fd = -1;
+        }
+
+        void FlushClient(client &c)
+        {
+            while (!c.queue.Empty())
+            {
+                ssize_t nLen = c.queue.Write(c.fd, true);
+                if (nLen == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (errno != EAGAIN)
+                    {
+                        Close(c);
+                        return;
+                    }
+                    break;
+                }
+            }
+            WaitOut(c, !c.queue.Empty());
+        }
+
+        void WaitOut(client &c, bool bWait)
+        {
+            if (bWait == c.bWaitOut)
+            {
+                return;
+            }
+
+            struct epoll_event ev;
+            ev.events = bWait ? (EPOLLIN|EPOLLOUT) : EPOLLIN;
+            ev.data.fd = c.fd;
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+            c.bWaitOut = bWait;
+        }
+
+    private:
+        int m_listen_fd;
+        int m_epoll_fd;
+        int m_nPolicy;
+        bool m_bTag;
+        char m_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+        client m_clients[MAX_CLIENTS];
+};
+
+#endif
@@ -0,0 +1,191 @@
+// @brief: unix domain socket that answers every connection with the
+//         runtime statistics and closes it, or a file rewritten with them
+//
+//    socat - UNIX-CONNECT:/run/mouse_stats
+//
+// the report is Prometheus text: one counter per RuntimeCounters entry and
+// a summary per latency histogram, quantiles in us
+//
+//    mouse_capture_packets_total 1234
+//    mouse_capture_latency_us{stage="emit",quantile="0.99"} 14
+//
+// served from the main epoll loop, the report is a few KB and goes out
+// with one non-blocking write. WriteFile() renames a complete report over
+// the file, a scraper reading it from tmpfs never sees half of one
+
+#ifndef STATS_SOCKET_H
+#define STATS_SOCKET_H
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "latency_stats.h"
+#include "runtime_counters.h"
+
+class StatsSocket
+{
+    public:
+        enum { REPORT_SIZE = 8192 };
+
+    public:
+        StatsSocket(LatencyStats &stats, RuntimeCounters &counters)
+        :m_stats(stats),
+        m_counters(counters),
+        m_listen_fd(-1)
+        {
+            m_path[0] = '\0';
+        }
+
+        ~StatsSocket()
+        {
+            if (m_listen_fd != -1)
+            {
+                close(m_listen_fd);
+                unlink(m_path);
+            }
+        }
+
+        bool Listen(const char *path, int epoll_fd)
+        {
+            struct sockaddr_un addr;
+            if (strlen(path) >= sizeof(addr.sun_path))
+            {
+                return false;
+            }
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, path);
+
+            m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (m_listen_fd == -1)
+            {
+                return false;
+            }
+            fcntl(m_listen_fd, F_SETFL, O_NONBLOCK);
+            fcntl(m_listen_fd, F_SETFD, FD_CLOEXEC);
+
+            // stale socket of a previous run
+            unlink(path);
+            if (bind(m_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+                listen(m_listen_fd, 4) == -1)
+            {
+                close(m_listen_fd);
+                m_listen_fd = -1;
+                return false;
+            }
+            strcpy(m_path, path);
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = m_listen_fd;
+            return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &ev) == 0;
+        }
+
+        bool Owns(int fd)
+        {
+            return fd != -1 && fd == m_listen_fd;
+        }
+
+        // answer every pending connection
+        void Event()
+        {
+            int fd;
+            while ((fd = accept(m_listen_fd, NULL, NULL)) != -1)
+            {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                Report(fd);
+                close(fd);
+            }
+        }
+
+        // the report to fd, also used for SIGUSR1 on stderr
+        void Report(int fd)
+        {
+            char buf[REPORT_SIZE];
+            int nLen = Format(buf, sizeof(buf));
+            if (write(fd, buf, nLen) != nLen)
+            {
+                // a reader that does not take a few KB gets less
+            }
+        }
+
+        // the report to path, through path.tmp and rename
+        bool WriteFile(const char *path)
+        {
+            char tmp[PATH_SIZE];
+            if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+            {
+                return false;
+            }
+            int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+            if (fd == -1)
+            {
+                return false;
+            }
+            char buf[REPORT_SIZE];
+            int nLen = Format(buf, sizeof(buf));
+            bool bOk = write(fd, buf, nLen) == nLen;
+            close(fd);
+            return bOk && rename(tmp, path) == 0;
+        }
+
+    private:
+        enum { PATH_SIZE = 256 };
+
+        int Format(char *buf, int nSize)
+        {
+            int nLen = 0;
+            for (int i = 0; i < RuntimeCounters::COUNTERS && nLen < nSize; i++)
+            {
+                const char *name = RuntimeCounters::Name(i);
+                nLen += snprintf(buf + nLen, nSize - nLen,
+                        "# HELP mouse_capture_%s_total %s.\n"
+                        "# TYPE mouse_capture_%s_total counter\n"
+                        "mouse_capture_%s_total %llu\n",
+                        name, RuntimeCounters::Help(i), name, name,
+                        (unsigned long long)m_counters.Get(i));
+            }
+            if (nLen < nSize)
+            {
+                nLen += snprintf(buf + nLen, nSize - nLen,
+                        "# HELP mouse_capture_latency_us Latency by stage (latency_stats.h).\n"
+                        "# TYPE mouse_capture_latency_us summary\n");
+            }
+            static const unsigned permille[] = { 500, 900, 990, 999 };
+            static const char *quantile[] = { "0.5", "0.9", "0.99", "0.999", "1" };
+            for (int i = 0; i < LatencyStats::HISTS && nLen < nSize; i++)
+            {
+                LogLinearHistogram &h = m_stats.Hist(i);
+                const char *stage = LatencyStats::Name(i);
+                for (int q = 0; q < 5 && nLen < nSize; q++)
+                {
+                    // quantile 1 is the max
+                    nLen += snprintf(buf + nLen, nSize - nLen,
+                            "mouse_capture_latency_us{stage=\"%s\",quantile=\"%s\"} %u\n",
+                            stage, quantile[q], q < 4 ? h.Percentile(permille[q]) : h.Max());
+                }
+                if (nLen < nSize)
+                {
+                    nLen += snprintf(buf + nLen, nSize - nLen,
+                            "mouse_capture_latency_us_sum{stage=\"%s\"} %llu\n"
+                            "mouse_capture_latency_us_count{stage=\"%s\"} %u\n",
+                            stage, (unsigned long long)h.Sum(), stage, h.Total());
+                }
+            }
+            return nLen < nSize ? nLen : nSize - 1;
+        }
+
+    private:
+        LatencyStats &m_stats;
+        RuntimeCounters &m_counters;
+        int m_listen_fd;
+        char m_path[108];
+};
+
+#endif
@@ -0,0 +1,129 @@
+// @brief: generated clicks as a report source for the virtual clock
+//
+// groups of clicks of one button: every click is a press and a release
+// hold later, the presses of a group are gap apart, the groups pause
+// apart. reports are made when asked for, so a run of millions needs no
+// memory. a wheel detent can follow every group, it closes a pending
+// click like a real wheel does (-m)
+
+#ifndef SYNTHETIC_MOUSE_H
+#define SYNTHETIC_MOUSE_H
+
+#include <string.h>
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+#include "wheel_accumulator.h"
+#include "gesture_table.h"
+
+class SyntheticMouse
+{
+    public:
+        SyntheticMouse()
+        :m_nButton(GestureTable::BUTTON_LEFT),
+        m_tick_hold(50 * TICKS_PER_MS),
+        m_tick_gap(150 * TICKS_PER_MS),
+        m_tick_pause(TICKS_PER_SEC),
+        m_nClicks(1),
+        m_nWheel(0),
+        m_nGroups(0)
+        {
+            Rewind(0);
+        }
+
+        // nGroups groups of nClicks clicks of button (GestureTable::BUTTON_*)
+        void Clicks(int button, int nClicks, tick_t hold, tick_t gap, tick_t pause, unsigned nGroups)
+        {
+            m_nButton = button;
+            m_nClicks = nClicks;
+            m_tick_hold = hold;
+            m_tick_gap = gap;
+            m_tick_pause = pause;
+            m_nGroups = nGroups;
+        }
+
+        // detents after every group half way into the pause, > 0 rolling down
+        void Wheel(int nDetents)
+        {
+            m_nWheel = nDetents;
+        }
+
+        // start over, the first press at time
+        void Rewind(tick_t time)
+        {
+            m_tick_group = time;
+            m_nGroup = 0;
+            m_nStep = 0;
+        }
+
+        bool Peek(tick_t &time)
+        {
+            if (m_nGroup >= m_nGroups)
+            {
+                return false;
+            }
+            time = StepTime();
+            return true;
+        }
+
+        bool Next(mouse_report &report)
+        {
+            if (m_nGroup >= m_nGroups)
+            {
+                return false;
+            }
+
+            memset(&report, 0, sizeof(report));
+            report.time = StepTime();
+            int nClickSteps = m_nClicks * 2;
+            if (m_nStep < nClickSteps)
+            {
+                // even steps press, odd ones release
+                bool bDown = (m_nStep & 1) == 0;
+                report.btn_left = bDown && m_nButton == GestureTable::BUTTON_LEFT;
+                report.btn_right = bDown && m_nButton == GestureTable::BUTTON_RIGHT;
+                report.btn_middle = bDown && m_nButton == GestureTable::BUTTON_MIDDLE;
+            }
+            else
+            {
+                report.z = m_nWheel;
+                report.z_hires = m_nWheel * WheelAccumulator::UNITS_PER_DETENT;
+            }
+
+            m_nStep++;
+            if (m_nStep >= nClickSteps + (m_nWheel ? 1 : 0))
+            {
+                m_tick_group += (tick_t)(m_nClicks - 1) * m_tick_gap + m_tick_pause;
+                m_nGroup++;
+                m_nStep = 0;
+            }
+            return true;
+        }
+
+    private:
+        tick_t StepTime()
+        {
+            if (m_nStep >= m_nClicks * 2)
+            {
+                return m_tick_group + (tick_t)(m_nClicks - 1) * m_tick_gap + m_tick_pause / 2;
+            }
+            return m_tick_group + (tick_t)(m_nStep / 2) * m_tick_gap + ((m_nStep & 1) ? m_tick_hold : 0);
+        }
+
+    private:
+        int m_nButton;
+        tick_t m_tick_hold;
+        tick_t m_tick_gap;
+        tick_t m_tick_pause;
+        int m_nClicks;
+        int m_nWheel;
+        unsigned m_nGroups;
+
+        // press of the first click of the current group
+        tick_t m_tick_group;
+        unsigned m_nGroup;
+        // press, release, ... wheel
+        int m_nStep;
+};
+
+#endif
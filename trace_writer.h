@@ -0,0 +1,296 @@
+// @brief: timeline of the event loop in Chrome trace event JSON (--trace),
+//         for chrome://tracing, ui.perfetto.dev or speedscope
+//
+// events go as fixed size records into a pre-allocated array, no
+// allocation and no syscall on the event path. the array is formatted and
+// written in chunks when it is full or a second after the last write,
+// that write shows up in the trace itself as "trace flush"
+//
+//    wait      epoll_pwait() blocked, args: ready fds
+//    read      one read of an input fd, args: bytes
+//    report    a decoded report, args: buttons x y wheel units
+//    state     gesture transition, args: symbol from to timer
+//    arm       alarm set, args: us to the deadline, or "disarm"
+//    timer     expired alarm served, args: us late
+//    action    action emitted, args: code count
+//    write     one writev() of the output queue, args: bytes
+//
+// tid 0 is the loop, tid N + 1 is device N (0 is /dev/input/mice). times
+// are us of CLOCK_MONOTONIC, kernel event stamps and read times line up.
+// the file is a JSON array, a trace cut by a crash lacks only the "]"
+// that trace viewers do not need
+
+#ifndef TRACE_WRITER_H
+#define TRACE_WRITER_H
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mono_tick.h"
+
+class TraceWriter
+{
+    public:
+        enum {
+            EVENTS = 2048,          // 64 KB of records
+            CHUNK_SIZE = 16384,     // text per write()
+            FLUSH_TICKS = TICKS_PER_SEC
+        };
+
+        enum {
+            TRACE_WAIT,
+            TRACE_READ,
+            TRACE_REPORT,
+            TRACE_STATE,
+            TRACE_ARM,
+            TRACE_TIMER,
+            TRACE_ACTION,
+            TRACE_WRITE,
+            TRACE_FLUSH
+        };
+
+    public:
+        TraceWriter()
+        :m_fd(-1),
+        m_nCount(0),
+        m_bFirst(true),
+        m_nNamed(0),
+        m_pid(0),
+        m_tick_flush(0)
+        {
+        }
+
+        ~TraceWriter()
+        {
+            Close();
+        }
+
+        bool Open(const char *path)
+        {
+            m_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+            if (m_fd == -1)
+            {
+                return false;
+            }
+            m_pid = getpid();
+            m_tick_flush = NowTick();
+            return Write("[\n", 2);
+        }
+
+        bool IsOpen()
+        {
+            return m_fd != -1;
+        }
+
+        void Close()
+        {
+            if (m_fd != -1)
+            {
+                Flush();
+                Write("\n]\n", 3);
+                close(m_fd);
+                m_fd = -1;
+            }
+        }
+
+        // a span from start to end
+        void Slice(int kind, int tid, tick_t start, tick_t end, int32_t a = 0)
+        {
+            Add(kind, tid, start, (int32_t)(end - start), 0, a, 0, 0);
+        }
+
+        // a point in time
+        void Instant(int kind, int tid, tick_t time, int x, int32_t a = 0, int32_t b = 0, int32_t c = 0)
+        {
+            Add(kind, tid, time, 0, x, a, b, c);
+        }
+
+        // format and write every record, false on write error (the trace stops)
+        bool Flush()
+        {
+            if (m_fd == -1)
+            {
+                return false;
+            }
+            tick_t start = NowTick();
+            unsigned nCount = m_nCount;
+            unsigned nLen = 0;
+            for (unsigned i = 0; i < nCount; i++)
+            {
+                // one event with its thread name is well below 512 bytes
+                if (nLen > CHUNK_SIZE - 512)
+                {
+                    if (!Write(m_chunk, nLen))
+                    {
+                        return false;
+                    }
+                    nLen = 0;
+                }
+                nLen += Format(m_events[i], m_chunk + nLen, CHUNK_SIZE - nLen);
+            }
+            m_nCount = 0;
+            if (!Write(m_chunk, nLen))
+            {
+                return false;
+            }
+
+            // the flush itself, it holds up the loop too
+            m_tick_flush = NowTick();
+            Add(TRACE_FLUSH, 0, start, (int32_t)(m_tick_flush - start), 0, nCount, 0, 0);
+            return true;
+        }
+
+    private:
+        struct record
+        {
+            tick_t time;
+            int32_t dur;
+            uint16_t tid;
+            uint8_t kind;
+            uint8_t x;
+            int32_t a;
+            int32_t b;
+            int32_t c;
+        };
+
+        void Add(int kind, int tid, tick_t time, int32_t dur, int x, int32_t a, int32_t b, int32_t c)
+        {
+            if (m_fd == -1)
+            {
+                return;
+            }
+            record &r = m_events[m_nCount++];
+            r.time = time;
+            r.dur = dur;
+            r.tid = tid;
+            r.kind = kind;
+            r.x = x;
+            r.a = a;
+            r.b = b;
+            r.c = c;
+            if (m_nCount == (unsigned)EVENTS || time - m_tick_flush >= FLUSH_TICKS)
+            {
+                Flush();
+            }
+        }
+
+        unsigned Format(const record &r, char *p, unsigned nSize)
+        {
+            int nLen = 0;
+            if (r.tid < 32 && !(m_nNamed & (1u << r.tid)))
+            {
+                // thread_name metadata before the first event of a track
+                m_nNamed |= 1u << r.tid;
+                char name[16];
+                if (r.tid == 0)
+                {
+                    strcpy(name, "loop");
+                }
+                else
+                {
+                    snprintf(name, sizeof(name), "dev %d", r.tid - 1);
+                }
+                nLen += snprintf(p + nLen, nSize - nLen,
+                        "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                        "\"args\":{\"name\":\"%s\"}}", Separator(), m_pid, r.tid, name);
+            }
+
+            long long ts = (long long)r.time;
+            switch (r.kind)
+            {
+                case TRACE_WAIT:
+                case TRACE_READ:
+                case TRACE_TIMER:
+                case TRACE_WRITE:
+                case TRACE_FLUSH:
+                {
+                    static const char *names[] = { "wait", "read", "", "", "", "timer", "", "write", "trace flush" };
+                    static const char *args[] = { "fds", "bytes", "", "", "", "late_us", "", "bytes", "events" };
+                    nLen += snprintf(p + nLen, nSize - nLen,
+                            "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%d,\"pid\":%d,\"tid\":%d,"
+                            "\"args\":{\"%s\":%d}}", Separator(), names[r.kind], ts, r.dur, m_pid, r.tid,
+                            args[r.kind], r.a);
+                    break;
+                }
+                case TRACE_REPORT:
+                    nLen += snprintf(p + nLen, nSize - nLen,
+                            "%s{\"name\":\"report\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,"
+                            "\"args\":{\"buttons\":%d,\"x\":%d,\"y\":%d,\"wheel\":%d}}",
+                            Separator(), ts, m_pid, r.tid, r.x, r.a, r.b, r.c);
+                    break;
+                case TRACE_STATE:
+                    nLen += snprintf(p + nLen, nSize - nLen,
+                            "%s{\"name\":\"state\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,"
+                            "\"args\":{\"sym\":%d,\"from\":%d,\"to\":%d,\"timer\":%d}}",
+                            Separator(), ts, m_pid, r.tid, r.x, r.a, r.b, r.c);
+                    break;
+                case TRACE_ARM:
+                    nLen += snprintf(p + nLen, nSize - nLen,
+                            "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,"
+                            "\"args\":{\"in_us\":%d}}",
+                            Separator(), r.x ? "arm" : "disarm", ts, m_pid, r.tid, r.a);
+                    break;
+                case TRACE_ACTION:
+                {
+                    char code = r.x >= 0x20 && r.x < 0x7f && r.x != '"' && r.x != '\\' ? (char)r.x : '?';
+                    nLen += snprintf(p + nLen, nSize - nLen,
+                            "%s{\"name\":\"action\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,"
+                            "\"args\":{\"code\":\"%c\",\"count\":%d}}",
+                            Separator(), ts, m_pid, r.tid, code, r.a);
+                    break;
+                }
+            }
+            return (unsigned)nLen < nSize ? nLen : nSize - 1;
+        }
+
+        // no comma before the first event, none after the last
+        const char *Separator()
+        {
+            if (m_bFirst)
+            {
+                m_bFirst = false;
+                return "";
+            }
+            return ",\n";
+        }
+
+        bool Write(const char *p, unsigned nLen)
+        {
+            unsigned nPos = 0;
+            while (nPos < nLen && m_fd != -1)
+            {
+                ssize_t n = write(m_fd, p + nPos, nLen - nPos);
+                if (n == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    close(m_fd);
+                    m_fd = -1;
+                    m_nCount = 0;
+                    return false;
+                }
+                nPos += n;
+            }
+            return m_fd != -1;
+        }
+
+    private:
+        int m_fd;
+        record m_events[EVENTS];
+        unsigned m_nCount;
+        char m_chunk[CHUNK_SIZE];
+
+        bool m_bFirst;
+        // tracks that have their thread_name
+        uint32_t m_nNamed;
+        int m_pid;
+        tick_t m_tick_flush;
+};
+
+#endif
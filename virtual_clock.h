@@ -0,0 +1,100 @@
+// @brief: a gesture state driven on a virtual clock instead of epoll
+//
+// the clock jumps from event to event: to the next report of the source
+// or to the next deadline of the process, whichever comes first, so the
+// logic runs as fast as the CPU allows and a 299 ms gap is exactly
+// 299 ms. Process is a BasicButtonProcess with a VirtualAlarm, Source
+// gives reports in time order:
+//
+//    bool Peek(tick_t &time)         time of the next report, false at the end
+//    bool Next(mouse_report &report) the next report
+//
+// SyntheticMouse (synthetic_mouse.h) is one, CaptureReplay
+// (capture_replay.h) plays recorded raw input the same way for many
+// devices at once
+
+#ifndef VIRTUAL_CLOCK_H
+#define VIRTUAL_CLOCK_H
+
+#include "mono_tick.h"
+#include "mouse_report.h"
+
+template <class Source, class Process>
+class VirtualClock
+{
+    public:
+        VirtualClock(Source &source, Process &process)
+        :m_source(source),
+        m_process(process),
+        m_tick_now(0)
+        {
+        }
+
+        tick_t Now()
+        {
+            return m_tick_now;
+        }
+
+        // time of the next step, false when the source is done and
+        // nothing is pending
+        bool Due(tick_t &time)
+        {
+            tick_t deadline;
+            bool bDeadline = m_process.NextDeadline(deadline);
+            if (!m_source.Peek(time))
+            {
+                time = deadline;
+                return bDeadline;
+            }
+            if (bDeadline && deadline <= time)
+            {
+                // the window closes before the report, like a timerfd
+                // served first
+                time = deadline;
+            }
+            return true;
+        }
+
+        // one deadline or one report, false on quit
+        bool Step()
+        {
+            tick_t time;
+            if (!Due(time))
+            {
+                return true;
+            }
+            m_tick_now = time;
+
+            tick_t deadline;
+            if (m_process.NextDeadline(deadline) && deadline == time)
+            {
+                m_process.Timer(time);
+                return true;
+            }
+
+            mouse_report report;
+            m_source.Next(report);
+            return m_process.Report(report);
+        }
+
+        // until the source is done and nothing is pending, false on quit
+        bool Run()
+        {
+            tick_t time;
+            while (Due(time))
+            {
+                if (!Step())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        Source &m_source;
+        Process &m_process;
+        tick_t m_tick_now;
+};
+
+#endif
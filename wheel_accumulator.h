@@ -0,0 +1,114 @@
+// @brief: high resolution wheel units split into detents and fine steps
+//
+// evdev REL_WHEEL_HI_RES and REL_HWHEEL_HI_RES count 120 units per detent,
+// a free spinning or high resolution wheel reports a fraction of that per
+// event. the partial detent and the partial fine step are carried in
+// integers, a turn of direction drops them like the kernel does for its
+// own REL_WHEEL, so a wiggle never adds up to a detent
+
+#ifndef WHEEL_ACCUMULATOR_H
+#define WHEEL_ACCUMULATOR_H
+
+#include <stdint.h>
+
+class WheelAccumulator
+{
+    public:
+        enum { UNITS_PER_DETENT = 120 };
+
+    public:
+        WheelAccumulator()
+        :m_nFine(0),
+        m_nShift(-1),
+        m_nRecip(0),
+        m_nExact(0),
+        m_nDetentPart(0),
+        m_nFinePart(0)
+        {
+        }
+
+        // fine step in units, 0 has no fine steps. the divide by it is
+        // worked out here, not per wheel event: a shift for a power of
+        // two, else a multiply by the 32 bit reciprocal rounded up
+        void Setup(int fine)
+        {
+            m_nFine = fine;
+            m_nShift = -1;
+            m_nRecip = 0;
+            m_nExact = 0;
+            if (fine <= 0)
+            {
+                return;
+            }
+            if ((fine & (fine - 1)) == 0)
+            {
+                m_nShift = 0;
+                while ((1 << m_nShift) != fine)
+                {
+                    m_nShift++;
+                }
+                return;
+            }
+            m_nRecip = (uint32_t)(0xffffffffU / (unsigned)fine + 1);
+            // n * fine < 2^32 keeps the rounding error below one step
+            m_nExact = 0xffffffffU / (unsigned)fine;
+        }
+
+        // units of one report, > 0 rolling down (right). detents and fine
+        // steps that completed, signed like units
+        void Add(int units, int &detents, int &fine)
+        {
+            if ((units > 0 && (m_nDetentPart < 0 || m_nFinePart < 0)) ||
+                (units < 0 && (m_nDetentPart > 0 || m_nFinePart > 0)))
+            {
+                m_nDetentPart = 0;
+                m_nFinePart = 0;
+            }
+
+            // C++ division truncates to zero, the remainder keeps the sign
+            m_nDetentPart += units;
+            detents = m_nDetentPart / UNITS_PER_DETENT;
+            m_nDetentPart -= detents * UNITS_PER_DETENT;
+
+            fine = 0;
+            if (m_nFine > 0)
+            {
+                m_nFinePart += units;
+                fine = Steps(m_nFinePart);
+                m_nFinePart -= fine * m_nFine;
+            }
+        }
+
+    private:
+        // units / m_nFine, truncated to zero like the divide
+        int Steps(int units) const
+        {
+            unsigned n = units < 0 ? 0U - (unsigned)units : (unsigned)units;
+            unsigned q;
+            if (m_nShift >= 0)
+            {
+                q = n >> m_nShift;
+            }
+            else if (n <= m_nExact)
+            {
+                q = (unsigned)(((uint64_t)n * m_nRecip) >> 32);
+            }
+            else
+            {
+                // more than any report carries
+                q = n / (unsigned)m_nFine;
+            }
+            return units < 0 ? -(int)q : (int)q;
+        }
+
+    private:
+        int m_nFine;
+        // m_nShift >= 0 for a power of two, else m_nRecip up to m_nExact
+        int m_nShift;
+        uint32_t m_nRecip;
+        unsigned m_nExact;
+        int m_nDetentPart;
+        int m_nFinePart;
+};
+
+#endif
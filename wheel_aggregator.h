@@ -0,0 +1,136 @@
+// @brief: wheel detents summed over a short window, one action per window
+//
+// the first detent after a quiet wheel goes out at once, so a single notch
+// is never late. the detents that follow within the window are summed and
+// sent as one action with a count when the window closes; the window then
+// opens again while the wheel keeps spinning, so a fast spin gives one
+// action per window instead of one per report.
+//
+// the count can go through a velocity curve: n detents in one window is
+// the speed, every detent past the first adds accel/256 to the gain. all
+// integer, the target has no FPU
+
+#ifndef WHEEL_AGGREGATOR_H
+#define WHEEL_AGGREGATOR_H
+
+#include "mono_tick.h"
+
+class WheelAggregator
+{
+    public:
+        enum {
+            GAIN_SHIFT = 8,                 // gain is Q8, 256 is 1.0
+            MAX_GAIN = 8 << GAIN_SHIFT,
+            MAX_COUNT = 255                 // fits the shm record
+        };
+
+    public:
+        WheelAggregator()
+        :m_tick_window(0),
+        m_nAccel(0),
+        m_bOpen(false),
+        m_nDir(0),
+        m_nCount(0),
+        m_tick_deadline(0)
+        {
+        }
+
+        // window 0 is off, every report goes out by itself
+        void Setup(tick_t window, int accel)
+        {
+            m_tick_window = window;
+            m_nAccel = accel;
+        }
+
+        bool IsOpen()
+        {
+            return m_bOpen;
+        }
+
+        // detents summed and not sent yet
+        bool Pending()
+        {
+            return m_nCount > 0;
+        }
+
+        // > 0 rolling down
+        int Dir()
+        {
+            return m_nDir;
+        }
+
+        tick_t Deadline()
+        {
+            return m_tick_deadline;
+        }
+
+        // n detents in direction dir. return the count to send now,
+        // 0 if it is summed. the caller sends the pending ones first
+        // when the direction turns
+        int Add(int dir, int n, tick_t now)
+        {
+            if (m_tick_window == 0)
+            {
+                return Clamp(n);
+            }
+            if (!m_bOpen)
+            {
+                m_bOpen = true;
+                m_nDir = dir;
+                m_tick_deadline = now + m_tick_window;
+                return Clamp(n);
+            }
+            m_nDir = dir;
+            m_nCount += n;
+            if (m_nCount > MAX_COUNT)
+            {
+                m_nCount = MAX_COUNT;
+            }
+            return 0;
+        }
+
+        // the window closed or the pending detents have to go now: count
+        // to send, 0 if none came and the wheel is quiet again
+        int Close(tick_t now)
+        {
+            int n = m_nCount;
+            m_nCount = 0;
+            if (n == 0)
+            {
+                m_bOpen = false;
+                return 0;
+            }
+            m_tick_deadline = now + m_tick_window;
+            return Curve(n);
+        }
+
+    private:
+        int Curve(int n)
+        {
+            if (m_nAccel == 0)
+            {
+                return n;
+            }
+            int gain = (1 << GAIN_SHIFT) + m_nAccel * (n - 1);
+            if (gain > MAX_GAIN)
+            {
+                gain = MAX_GAIN;
+            }
+            return Clamp((n * gain + (1 << (GAIN_SHIFT - 1))) >> GAIN_SHIFT);
+        }
+
+        static int Clamp(int n)
+        {
+            return n < MAX_COUNT ? n : MAX_COUNT;
+        }
+
+    private:
+        tick_t m_tick_window;
+        int m_nAccel;
+        bool m_bOpen;
+        int m_nDir;
+        int m_nCount;
+        tick_t m_tick_deadline;
+};
+
+#endif